@@ -12,6 +12,8 @@
 #define	_DS18B20_H
 
 #include "onewire.h"
+#include "onewire_async.h"
+#include "onewire_multi.h"
 
 //
 //	CONFIGURATION
@@ -19,23 +21,52 @@
 
 //	Remember to configure a timer on CubeMX 1us per tick
 //	example 72 MHz cpu - Prescaler=(72-1), Counter period=65000
-#define _DS18B20_MAX_SENSORS		    4
-#define	_DS18B20_GPIO					DS18B20_GPIO_Port
-#define	_DS18B20_PIN					DS18B20_Pin
-
 #define	_DS18B20_TIMER					htim1
 
+//	CRC of the configuration reads and DS18B20_MultiRead. Temperature
+//	reads follow the runtime policy below.
 //#define _DS18B20_USE_CRC
 
-//
-//	Sensor structure
-//
-typedef struct
-{
-	uint8_t 	Address[8];
-	float 		Temperature;
-	uint8_t		ValidDataFlag;
-} Ds18b20Sensor_t;
+//	Temperature reads (DS18B20_SetVerify) - only the 2 temperature bytes
+//	are read and the rest of the scratchpad is cut by a reset. The full
+//	scratchpad with its CRC is read for one read in _DS18B20_VERIFY_EVERY
+//	and for a value that does not fit: 0xFFFF (open bus), the 85 degC
+//	power-on value, or a change faster than _DS18B20_VERIFY_RATE
+//	[1/16 degC per s] since the last reading.
+#define _DS18B20_VERIFY_EVERY			16
+#define _DS18B20_VERIFY_RATE			160
+
+//	Float helpers (DS18B20_GetTemperatureFloat). The driver itself works on
+//	signed 1/16 degC values and does not need float support.
+//#define _DS18B20_USE_FLOAT
+
+//	Change-driven reads (DS18B20_ReadChanged) - TH/TL band around the last
+//	reading [whole degC] and calls between full reads of all sensors
+#define _DS18B20_CHANGE_BAND			1
+#define _DS18B20_CHANGE_REFRESH			60
+
+//	Parasite-powered sensors converting at once on the strong pull-up.
+//	With more of them on a bus they take turns, one per StartAll.
+#define _DS18B20_PARASITE_MAX			8
+
+//	Adaptive resolution (DS18B20_SetAdaptive) - rate of change that drops
+//	a sensor to the fastest resolution and the rate below which it goes
+//	one step back up [1/16 degC per s]
+#define _DS18B20_ADAPTIVE_FAST			16
+#define _DS18B20_ADAPTIVE_SLOW			2
+
+//	Hot-plug (DS18B20_Hotplug) - verify passes a sensor has to miss in a
+//	row before it is dropped, one noisy bit does not renumber the table
+#define _DS18B20_HOTPLUG_MISSES			3
+
+//	Keep the found sensors in flash (ds18b20_store.c). Init checks the
+//	stored ones and searches the bus only when one of them is gone or
+//	a new DS18B20 branches off their ROMs.
+//	The sector has to be left out of FLASH in the linker script.
+#define _DS18B20_ROM_STORE
+#define _DS18B20_ROM_STORE_SECTOR		FLASH_SECTOR_7
+#define _DS18B20_ROM_STORE_ADDRESS		(FLASH_BASE + 0x60000) // Sector 7, 128 kB
+#define _DS18B20_ROM_STORE_SIZE			0x20000
 
 //
 //	DEFINES
@@ -45,7 +76,9 @@ typedef struct
 #define DS18B20_CMD_ALARMSEARCH			0xEC
 #define DS18B20_CMD_CONVERTTEMP			0x44
 
-#define DS18B20_STEP_12BIT		0.0625
+#define DS18B20_COPY_TIME				10 // EEPROM copy [ms], strong pull-up time for parasite power
+
+#define DS18B20_STEP_12BIT		0.0625 // 1 LSB of the raw value
 #define DS18B20_STEP_11BIT		0.125
 #define DS18B20_STEP_10BIT		0.25
 #define DS18B20_STEP_9BIT		0.5
@@ -53,12 +86,38 @@ typedef struct
 #define DS18B20_RESOLUTION_R1	6 // Resolution bit R1
 #define DS18B20_RESOLUTION_R0	5 // Resolution bit R0
 
+//
+//	Sensor status bits (bus->Status)
+//
+#define DS18B20_STATUS_VALID		0x01 // Temperature holds a valid reading
+#define DS18B20_STATUS_CONVERTING	0x02 // Conversion started, result not read yet
+#define DS18B20_STATUS_ALARM		0x04 // Found by the last DS18B20_AlarmScan
+#define DS18B20_STATUS_BAND			0x08 // TH/TL band set around Temperature (DS18B20_ReadChanged)
+#define DS18B20_STATUS_PARASITE		0x10 // Parasite-powered, needs the strong pull-up
+#define DS18B20_STATUS_RESOLUTION	0x60 // Last known resolution, R1 R0 like in the configuration register
+#define DS18B20_STATUS_CONFIG		0x80 // Config holds the TH, TL and configuration of the sensor's EEPROM
+
+#define DS18B20_NOT_FOUND		0xFF // DS18B20_Find result
+
+//
+//	Hot-plug events (DS18B20_Hotplug)
+//
+#define DS18B20_HOTPLUG_NONE		0
+#define DS18B20_HOTPLUG_ADDED		1 // New sensor appended to the table
+#define DS18B20_HOTPLUG_REMOVED		2 // Sensor gone, dropped from the table - later numbers move down
+
 #ifdef _DS18B20_USE_CRC
 #define DS18B20_DATA_LEN	9
 #else
 #define DS18B20_DATA_LEN	5
 #endif
 
+#define DS18B20_SELECT_LEN	(ONEWIRE_SELECT_LEN + 1) // Match ROM frame and the function command
+
+#define DS18B20_SCRATCHPAD_LEN	9 // Whole scratchpad with the CRC
+#define DS18B20_TEMPERATURE_LEN	2 // Early-terminated temperature read
+#define DS18B20_POWER_ON		0x0550 // 85 degC, temperature register after power-up
+
 typedef enum {
 	DS18B20_Resolution_9bits = 9,
 	DS18B20_Resolution_10bits = 10,
@@ -66,27 +125,144 @@ typedef enum {
 	DS18B20_Resolution_12bits = 12
 } DS18B20_Resolution_t;
 
+typedef enum {
+	DS18B20_POLL_IDLE,			// Next call starts a conversion
+	DS18B20_POLL_CONVERTING,	// Waiting for the conversion time
+	DS18B20_POLL_READING		// Scratchpad reads queued
+} DS18B20_PollState_t;
+
+//
+//	Bus structure - one per 1-Wire bus, passed to every call
+//
+//	The sensor table is a set of arrays owned by the caller, one entry
+//	per sensor number, so a pass over the readings touches only the
+//	Temperature and Status arrays. Sorted keeps the sensor numbers in
+//	ascending ROM order for DS18B20_Find. DS18B20_BUS_DEFINE declares a
+//	bus together with its arrays.
+//
+typedef struct Ds18b20Bus_t Ds18b20Bus_t;
+
+struct Ds18b20Bus_t
+{
+	OneWire_t		OneWire;		// Own bus instance
+	uint8_t			Capacity;		// Entries in every array below
+	uint8_t			SensorCount;
+	uint8_t			SingleDevice;	// Sensor 0 is the only device on the bus - Skip ROM instead of Match ROM
+	uint8_t			SensorsOnly;	// Nothing on the bus but the table sensors - Skip ROM writes reach no other device
+	uint8_t			(*Address)[8];	// ROM of every sensor
+	uint8_t			(*Select)[DS18B20_SELECT_LEN]; // Match ROM frame of every sensor, sent from here as one block
+	int16_t*		Temperature;	// 1/16 degC, undefined bits cleared
+	uint8_t*		Status;			// DS18B20_STATUS_* bits
+	uint8_t			(*Config)[3];	// EEPROM TH, TL, configuration - unchanged settings are not written again
+	uint32_t*		ConversionStart;// HAL_GetTick() when the conversion started
+	uint32_t*		SampleTick;		// ConversionStart of the reading in Temperature
+	uint8_t*		Sorted;			// Sensor numbers in ascending ROM order
+	DS18B20_PollState_t PollState;	// DS18B20_Poll scheduler
+	uint32_t		StaggerTick;	// Last conversion start of DS18B20_PollStaggered
+	uint8_t			StaggerNext;	// Sensor it checks first
+	uint8_t			ChangeCycle;	// DS18B20_ReadChanged calls since the last full read
+	uint8_t			Resolution;		// Set by DS18B20_InitBus, also given to hot-plugged sensors
+	uint8_t			ParasiteCount;	// Sensors with DS18B20_STATUS_PARASITE
+	uint8_t			ParasiteNext;	// Next parasite sensor to convert when they take turns
+	uint8_t			AdaptiveMin;	// Fastest resolution of the adaptive mode, 0 - off
+	uint8_t			VerifyEvery;	// Full scratchpad read every Nth temperature read, 1 - always, 0 - suspicious values only
+	uint8_t			VerifyCount;	// Temperature reads since the last full one
+
+	void			(*HotplugCallback)(Ds18b20Bus_t* bus, uint8_t number, uint8_t event); // Optional, ROM in bus->Address[number]
+	uint8_t			HotplugCursor;	// Next sensor to verify
+	uint8_t			HotplugMisses;	// Verify passes in a row the sensor at the cursor did not answer
+	uint8_t			HotplugBranch;	// Unknown branch to search: bit number + 1, 0 - none
+	uint8_t			HotplugPath[8];	// ROM path into that branch
+	uint8_t			HotplugChanged;	// Table changed in this round
+	uint8_t			HotplugUnknown;	// Round met a device outside the table, or a sensor that did not answer
+
+	OneWireAsync_t	StartTransaction;	// Non-blocking calls
+	OneWireAsync_t	ReadTransaction;	// Reused for one sensor after another
+	uint8_t			ReadNumber;			// Sensor read by ReadTransaction
+	uint8_t			ReadCommand[13];	// Match ROM or Skip ROM, Write Scratchpad and 3 bytes
+	uint8_t			ReadData[DS18B20_SCRATCHPAD_LEN];
+};
+
+//
+//	Bus @name with a table for up to @capacity sensors (max 254)
+//
+#define DS18B20_BUS_DEFINE(name, capacity)									\
+	static uint8_t name##_Address[capacity][8];								\
+	static uint8_t name##_Select[capacity][DS18B20_SELECT_LEN];				\
+	static int16_t name##_Temperature[capacity];							\
+	static uint8_t name##_Status[capacity];									\
+	static uint8_t name##_Config[capacity][3];								\
+	static uint32_t name##_ConversionStart[capacity];						\
+	static uint32_t name##_SampleTick[capacity];							\
+	static uint8_t name##_Sorted[capacity];									\
+	Ds18b20Bus_t name = {													\
+		.Capacity = (capacity),												\
+		.Address = name##_Address,											\
+		.Select = name##_Select,											\
+		.Temperature = name##_Temperature,									\
+		.Status = name##_Status,											\
+		.Config = name##_Config,											\
+		.ConversionStart = name##_ConversionStart,							\
+		.SampleTick = name##_SampleTick,									\
+		.Sorted = name##_Sorted,											\
+		.VerifyEvery = _DS18B20_VERIFY_EVERY,								\
+	}
+
 //
 //	FUNCTIONS
 //
 
 // 	Init
-void		DS18B20_Init(DS18B20_Resolution_t resolution);
+void		DS18B20_Init(Ds18b20Bus_t* bus, GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, DS18B20_Resolution_t resolution); // GPIO bit-bang on the pin
+void		DS18B20_InitBus(Ds18b20Bus_t* bus, DS18B20_Resolution_t resolution); // bus->OneWire already initialized, any backend
 //	Settings
-uint8_t 	DS18B20_GetResolution(uint8_t number); // Get the sensor resolution
-uint8_t 	DS18B20_SetResolution(uint8_t number, DS18B20_Resolution_t resolution);	// Set the sensor resolution
+uint8_t 	DS18B20_GetResolution(Ds18b20Bus_t* bus, uint8_t number); // Get the sensor resolution
+uint8_t 	DS18B20_SetResolution(Ds18b20Bus_t* bus, uint8_t number, DS18B20_Resolution_t resolution);	// Set the sensor resolution
+void		DS18B20_SetResolutionAll(Ds18b20Bus_t* bus, DS18B20_Resolution_t resolution); // Same resolution on all sensors
+void		DS18B20_SetAdaptive(Ds18b20Bus_t* bus, uint8_t fastest); // Resolution per sensor from its rate of change, 0 - off
+void		DS18B20_SetVerify(Ds18b20Bus_t* bus, uint8_t every); // Full CRC read every Nth temperature read, 1 - always, 0 - suspicious values only
+uint8_t		DS18B20_SetAlarm(Ds18b20Bus_t* bus, uint8_t number, int8_t th, int8_t tl); // Alarm when T >= TH or T <= TL [degC]
+void		DS18B20_SetAlarmAll(Ds18b20Bus_t* bus, int8_t th, int8_t tl); // Same thresholds on all sensors
+//	Alarms
+uint8_t		DS18B20_AlarmScan(Ds18b20Bus_t* bus, uint8_t* numbers, uint8_t max); // Alarm search, returns sensors out of TH/TL
 // Control
-uint8_t 	DS18B20_Start(uint8_t number); // Start conversion of one sensor
-void 		DS18B20_StartAll(void);	// Start conversion for all sensors
-uint8_t		DS18B20_Read(uint8_t number, float* destination); // Read one sensor
-void 		DS18B20_ReadAll(void);	// Read all connected sensors
+uint8_t 	DS18B20_Start(Ds18b20Bus_t* bus, uint8_t number); // Start conversion of one sensor
+void 		DS18B20_StartAll(Ds18b20Bus_t* bus);	// Start conversion for all sensors
+uint8_t		DS18B20_Read(Ds18b20Bus_t* bus, uint8_t number, int16_t* destination); // Read one sensor, 1/16 degC, kept in the table too
+void 		DS18B20_ReadAll(Ds18b20Bus_t* bus);	// Read all connected sensors
+uint8_t		DS18B20_ReadChanged(Ds18b20Bus_t* bus); // Read only sensors that left their TH/TL band, returns valid reads
 uint8_t 	DS18B20_Is(uint8_t* ROM); // Check if ROM address is DS18B20 family
-uint8_t 	DS18B20_AllDone(void);	// Check if all sensor's conversion is done
+uint8_t 	DS18B20_AllDone(Ds18b20Bus_t* bus);	// Check if all sensor's conversion is done
+//	Non-blocking control - GPIO bus only, results come from the timer interrupt
+uint8_t		DS18B20_StartAllAsync(Ds18b20Bus_t* bus); // Queue conversion start on all sensors
+uint8_t		DS18B20_ReadAllAsync(Ds18b20Bus_t* bus); // Queue reads of all sensors, 0 - nothing queued (previous reads still run, no sensors)
+uint8_t		DS18B20_AsyncBusy(Ds18b20Bus_t* bus); // Queued work of this bus not finished
+//	Scheduler
+uint16_t	DS18B20_ConversionTime(DS18B20_Resolution_t resolution); // Maximum conversion time [ms]
+uint32_t	DS18B20_TimeToReady(Ds18b20Bus_t* bus, uint8_t number); // ms until the result is due, 0 - ready
+uint32_t	DS18B20_TimeToReadyAll(Ds18b20Bus_t* bus); // ms until all results are due
+uint8_t		DS18B20_Poll(Ds18b20Bus_t* bus); // Call in the main loop, returns 1 when new results are in
+uint8_t		DS18B20_PollStaggered(Ds18b20Bus_t* bus); // Instead of DS18B20_Poll - sensors convert one after another, returns 1 per new result
+//	Parallel buses on one port
+uint16_t	DS18B20_MultiStartAll(OneWireMulti_t* multi); // Skip ROM Convert T on all buses, returns buses present
+uint16_t	DS18B20_MultiRead(OneWireMulti_t* multi, uint16_t pins, const uint8_t* ROM, int16_t* temperature); // One sensor per bus, returns buses with valid data
 //	ROMs
-void		DS18B20_GetROM(uint8_t number, uint8_t* ROM); // Get sensor's ROM from 'number' position
-void		DS18B20_WriteROM(uint8_t number, uint8_t* ROM); // Write a ROM to 'number' position in sensors table
+void		DS18B20_GetROM(Ds18b20Bus_t* bus, uint8_t number, uint8_t* ROM); // Get sensor's ROM from 'number' position
+void		DS18B20_WriteROM(Ds18b20Bus_t* bus, uint8_t number, uint8_t* ROM); // Write a ROM to 'number' position in sensors table
+uint8_t		DS18B20_Find(Ds18b20Bus_t* bus, const uint8_t* ROM); // Sensor number of the ROM, DS18B20_NOT_FOUND if it is not in the table
+uint8_t		DS18B20_IsPresent(Ds18b20Bus_t* bus, uint8_t number); // Search pass along the sensor's ROM, 1 - it answers
+//	Hot-plug
+uint8_t		DS18B20_Hotplug(Ds18b20Bus_t* bus); // Call in the main loop, one search pass per call, returns DS18B20_HOTPLUG_*
+uint8_t		DS18B20_UnknownBranch(Ds18b20Bus_t* bus, uint8_t number, uint8_t from); // After OneWire_Verify of @number, bit + 1 of a branch with no known sensor
 // Return functions
-uint8_t 	DS18B20_Quantity(void);	// Returns quantity of connected sensors
-uint8_t		DS18B20_GetTemperature(uint8_t number, float* destination); // Returns 0 if read data is invalid
+uint8_t 	DS18B20_Quantity(Ds18b20Bus_t* bus);	// Returns quantity of connected sensors
+uint8_t		DS18B20_GetTemperature(Ds18b20Bus_t* bus, uint8_t number, int16_t* destination); // 1/16 degC, returns 0 if read data is invalid
+uint8_t		DS18B20_GetTemperatureMilli(Ds18b20Bus_t* bus, uint8_t number, int32_t* destination); // Milli degC
+#ifdef _DS18B20_USE_FLOAT
+uint8_t		DS18B20_GetTemperatureFloat(Ds18b20Bus_t* bus, uint8_t number, float* destination);
 #endif
 
+//	Fixed-point conversions
+int32_t		DS18B20_ToMilliCelsius(int16_t raw); // 1/16 degC to milli degC
+int16_t		DS18B20_ToWholeCelsius(int16_t raw); // 1/16 degC to whole degC, rounded down like the TH/TL compare
+#endif
@@ -0,0 +1,39 @@
+/*
+ * ds18b20_store.h
+ *
+ *	The MIT License.
+ *
+ *	Sensor table of a bus kept in a reserved flash sector, so a restart
+ *	does not need the full ROM search. Every bus has a record with its
+ *	ROMs, the set resolution and a CRC16. Records are found by the bus
+ *	pin (GPIO backend) or the transport data address.
+ *
+ *	On boot every stored sensor is selected by a verify pass along its
+ *	ROM and its scratchpad is read up to the configuration byte, which
+ *	also fills the configuration cache. Any sensor that does not answer
+ *	with the stored resolution makes the caller search the bus again,
+ *	and so does a DS18B20 that the verify passes show in a branch of the
+ *	ROM tree with no stored sensor in it.
+ *
+ *	A changed table is appended behind the records already written, the
+ *	last one of a bus counts. The sector (_DS18B20_ROM_STORE_SECTOR) is
+ *	erased only when it is full; it has to be left out of the FLASH
+ *	region in the linker script.
+ *
+ */
+#ifndef DS18B20_STORE_H
+#define DS18B20_STORE_H
+
+#include "ds18b20.h"
+
+#ifdef _DS18B20_ROM_STORE
+
+//
+//	FUNCTIONS
+//
+uint8_t		DS18B20_StoreLoad(Ds18b20Bus_t* bus, DS18B20_Resolution_t resolution); // 1 - all stored sensors answered, table filled
+uint8_t		DS18B20_StoreSave(Ds18b20Bus_t* bus, DS18B20_Resolution_t resolution); // Write the table if it changed, 0 - flash error
+
+#endif
+
+#endif
@@ -12,18 +12,65 @@
 #define ONEWIRE_H 
 
 #include "gpio.h"
+#include "tim.h"
 
 //
-//	1-Wire bus structure
+//	CONFIGURATION
+//
+
+//	Keep the bus pin in open-drain output all the time (GPIO backend). The
+//	bus is released by writing the pin high and read back through IDR, so
+//	bit slots touch only BSRR and IDR. Comment out to switch pin direction
+//	in every slot.
+#define _ONEWIRE_OPEN_DRAIN
+
+typedef struct OneWire_t OneWire_t;
+
+//
+//	Backend operations - one table per transport
+//
+//	WriteBlock/ReadBlock move whole bytes, LSB first. Triplet is optional
+//	(NULL - built from ReadBit/WriteBit): it reads a search bit and its
+//	complement, then writes the direction - @direction when both are 0,
+//	otherwise the bit that is present. Returns ONEWIRE_TRIPLET_* bits.
+//	StrongPullup is optional too (NULL - the weak pull-up only, unless
+//	OneWire_SetPullupPin gives a MOSFET): it drives the idle line hard
+//	for parasite-powered devices.
 //
 typedef struct {
+	uint8_t (*Reset)(OneWire_t* onewire);
+	void (*WriteBit)(OneWire_t* onewire, uint8_t bit);
+	uint8_t (*ReadBit)(OneWire_t* onewire);
+	void (*WriteBlock)(OneWire_t* onewire, const uint8_t* data, uint16_t len);
+	void (*ReadBlock)(OneWire_t* onewire, uint8_t* data, uint16_t len);
+	uint8_t (*Triplet)(OneWire_t* onewire, uint8_t direction);
+	void (*StrongPullup)(OneWire_t* onewire, uint8_t on);
+} OneWire_Ops_t;
+
+#define ONEWIRE_TRIPLET_ID		0x01 // First bit read
+#define ONEWIRE_TRIPLET_CMP		0x02 // Complement read
+#define ONEWIRE_TRIPLET_DIR		0x04 // Direction written
+
+//
+//	1-Wire bus structure
+//
+struct OneWire_t {
+	const OneWire_Ops_t* Ops;      // Transport
+	void* Backend;                 // Transport data, eg. OneWireUart_t
 	GPIO_TypeDef* GPIOx;           // Bus GPIO Port
 	uint16_t GPIO_Pin;             // Bus GPIO Pin
+	TIM_HandleTypeDef* Timer;      // 1 us timer of onewire_async, started by OneWire_Init
+	uint32_t SlotEnd;              // Timebase cycle the last bit slot is over, the next one waits for it
 	uint8_t LastDiscrepancy;       // For searching purpose
 	uint8_t LastFamilyDiscrepancy; // For searching purpose
 	uint8_t LastDeviceFlag;        // For searching purpose
 	uint8_t ROM_NO[8];             // 8-byte ROM addres last found device
-} OneWire_t;
+	uint8_t Discrepancy[8];        // ROM bits where the last search saw devices on both branches
+	GPIO_TypeDef* PullupGPIOx;     // Strong pull-up MOSFET gate, NULL - transport StrongPullup operation
+	uint16_t PullupPin;
+	uint32_t PullupStart;          // HAL tick the strong pull-up went on
+	uint16_t PullupTime;           // How long it stays on [ms], 0 - off
+};
 
 //
 //	COMMANDS
@@ -38,14 +85,40 @@ typedef struct {
 #define ONEWIRE_CMD_MATCHROM			0x55
 #define ONEWIRE_CMD_SKIPROM				0xCC
 
+#define ONEWIRE_SELECT_LEN				9 // Match ROM frame - command and 8 ROM bytes
+
+//
+//	TIMINGS
+//
+#define ONEWIRE_RECOVERY_MAX			70 // Longest wait for the end of the last slot [us]
+
 //
 //	FUNCTIONS
 //
 
 //
-// Initialisation
+// Timebase - DWT cycle counter, never written, shared by every bus and interrupt
+//
+void OneWire_TimebaseInit(void); // OneWire_Init and OneWireMulti_Init call it
+uint32_t OneWire_Time(void); // Now [CPU cycles]
+uint32_t OneWire_Cycles(uint16_t us);
+void OneWire_WaitUntil(uint32_t deadline); // Up to 2^31 cycles ahead
+void OneWire_WaitIdle(OneWire_t* OneWireStruct); // Recovery of the last GPIO slot over, before other code drives the pin
+
+//
+// Initialisation - GPIO bit-bang backend
 //
 void OneWire_Init(OneWire_t* OneWireStruct, GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+void OneWire_InitWithOps(OneWire_t* OneWireStruct, const OneWire_Ops_t* Ops, void* Backend);
+
+void OneWire_SetPullupPin(OneWire_t* OneWireStruct, GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin); // P-MOSFET gate for the strong pull-up, active low, any transport
+
+//
+// Strong pull-up - parasite power during conversion and EEPROM copy
+//
+uint8_t OneWire_StrongPullup(OneWire_t* OneWireStruct, uint16_t ms); // Right after the last command bit, the next reset or read waits for its end. 0 - transport has none
+uint8_t OneWire_HasStrongPullup(OneWire_t* OneWireStruct); // 1 - MOSFET pin or transport pull-up, parasite power possible
+uint8_t OneWire_PullupActive(OneWire_t* OneWireStruct); // 1 - still on, 0 - off (switched off when its time passed)
 
 //
 // Reset bus
@@ -59,6 +132,9 @@ void OneWire_ResetSearch(OneWire_t* OneWireStruct);
 uint8_t OneWire_First(OneWire_t* OneWireStruct);
 uint8_t OneWire_Next(OneWire_t* OneWireStruct);
 uint8_t OneWire_Search(OneWire_t* OneWireStruct, uint8_t command);
+void OneWire_TargetSetup(OneWire_t* OneWireStruct, uint8_t family); // Next search starts at @family
+void OneWire_FamilySkipSetup(OneWire_t* OneWireStruct); // Next search skips the family of the last found device
+uint8_t OneWire_Verify(OneWire_t* OneWireStruct, const uint8_t* ROM); // 1 - device is on the bus, search state kept
 
 //
 // Writing/Reading
@@ -67,6 +143,9 @@ void OneWire_WriteBit(OneWire_t* OneWireStruct, uint8_t bit);
 uint8_t OneWire_ReadBit(OneWire_t* OneWireStruct);
 void OneWire_WriteByte(OneWire_t* OneWireStruct, uint8_t byte);
 uint8_t OneWire_ReadByte(OneWire_t* OneWireStruct);
+void OneWire_WriteBlock(OneWire_t* OneWireStruct, const uint8_t* data, uint16_t len);
+void OneWire_ReadBlock(OneWire_t* OneWireStruct, uint8_t* data, uint16_t len);
+uint8_t OneWire_Triplet(OneWire_t* OneWireStruct, uint8_t direction);
 
 //
 // ROM operations
@@ -74,6 +153,7 @@ uint8_t OneWire_ReadByte(OneWire_t* OneWireStruct);
 void OneWire_GetFullROM(OneWire_t* OneWireStruct, uint8_t *firstIndex);
 void OneWire_Select(OneWire_t* OneWireStruct, uint8_t* addr);
 void OneWire_SelectWithPointer(OneWire_t* OneWireStruct, uint8_t* ROM);
+void OneWire_SelectFrame(uint8_t* frame, const uint8_t* ROM); // Match ROM frame of ONEWIRE_SELECT_LEN bytes, ready for OneWire_WriteBlock
 
 //
 //	CRC calculating
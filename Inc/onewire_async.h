@@ -0,0 +1,86 @@
+/*
+ * onewire_async.h
+ *
+ *	The MIT License.
+ *
+ *	Non-blocking 1-Wire transactions on the GPIO bus. Every edge of a
+ *	bit slot is scheduled on the capture/compare channel 1 of the 1 us
+ *	timer, the interrupt moves the transaction one step forward. The
+ *	main loop only submits a transaction and gets a callback when it
+ *	is done.
+ *
+ *	CubeMX setup for the used timer:
+ *	- Free running up-counter, 1 us per tick, Counter period 65535
+ *	- TIMx capture compare interrupt enabled in NVIC, high priority
+ *	- TIMx_CC_IRQHandler has to call OneWireAsync_IRQHandler
+ *
+ *	With _ONEWIRE_ASYNC_DMA the transactions run from slot tables on
+ *	timer-triggered DMA (onewire_dma.c, CubeMX setup in onewire_dma.h)
+ *	and the compare interrupt is not used.
+ *
+ *	The bus pin has to stay in open-drain output (_ONEWIRE_OPEN_DRAIN).
+ *	Blocking calls on the same bus must not run while transactions are
+ *	queued.
+ *
+ */
+#ifndef ONEWIRE_ASYNC_H
+#define ONEWIRE_ASYNC_H
+
+#include "onewire.h"
+
+//
+//	CONFIGURATION
+//
+
+//	Run every transaction from slot tables on DMA requests of the timer
+//	instead of one compare interrupt per edge
+//#define _ONEWIRE_ASYNC_DMA
+
+//
+//	Transaction status
+//
+#define ONEWIRE_ASYNC_IDLE			0 // Never submitted
+#define ONEWIRE_ASYNC_PENDING		1 // Queued or running
+#define ONEWIRE_ASYNC_DONE			2 // Finished, RxData is valid
+#define ONEWIRE_ASYNC_NO_PRESENCE	3 // No device answered the reset
+
+//
+//	Transaction structure - reset, write @TxLen bytes, read @RxLen bytes
+//
+typedef struct OneWireAsync_t OneWireAsync_t;
+
+struct OneWireAsync_t {
+	OneWire_t* onewire;            // GPIO bus
+	uint8_t Reset;                 // Start with the reset pulse
+	const uint8_t* TxData;         // Written first, LSB first
+	uint8_t TxLen;
+	uint8_t* RxData;               // Read after TxData
+	uint8_t RxLen;
+	void (*Callback)(OneWireAsync_t* transaction); // Called from the timer interrupt, may be NULL
+	void* Context;                 // Free for the caller
+	volatile uint8_t Status;       // ONEWIRE_ASYNC_*
+	OneWireAsync_t* Next;          // Queue link
+};
+
+//
+//	FUNCTIONS
+//
+
+//
+// Initialisation - timer has to run already (OneWire_Init starts it), once per timer.
+// With _ONEWIRE_ASYNC_DMA nothing gets submitted when the timer has no DMA linked.
+//
+void OneWireAsync_Init(TIM_HandleTypeDef* htim);
+
+//
+// Transactions
+//
+uint8_t OneWireAsync_Submit(OneWireAsync_t* transaction); // Returns 0 if it is still pending
+uint8_t OneWireAsync_IsBusy(void); // Any transaction queued
+
+//
+// Has to be called from TIMx_CC_IRQHandler
+//
+void OneWireAsync_IRQHandler(TIM_HandleTypeDef* htim);
+
+#endif
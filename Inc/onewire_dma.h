@@ -0,0 +1,69 @@
+/*
+ * onewire_dma.h
+ *
+ *	The MIT License.
+ *
+ *	1-Wire transactions on the GPIO pin run from memory tables. While a
+ *	transaction runs the timer counts 70 us bit slots and four of its
+ *	DMA requests move half words between the tables and the port:
+ *	- Update (slot start) - pin low through the reset half of BSRR
+ *	- CC2 (2 us) - release for write 1 and read slots
+ *	- CC3 (12 us) - IDR sample of the slot
+ *	- CC4 (60 us) - release for write 0 slots
+ *	A reset is 7 slots held low and 7 slots released, the presence pulse
+ *	is the sample 80 us after the release. The CPU only builds the tables
+ *	and decodes the samples, slot timing does not depend on interrupts.
+ *
+ *	CubeMX setup for the used timer (TIM1 on the STM32F401 - DMA1 cannot
+ *	reach the GPIO ports and TIM1 is the only timer with DMA2 requests):
+ *	- 1 us per tick, Counter period 65535, no auto-reload preload
+ *	- DMA requests TIM1_UP, TIM1_CH2 and TIM1_CH4 Memory To Peripheral,
+ *	  TIM1_CH3 Peripheral To Memory; normal mode, half word on both
+ *	  sides, memory increment only, FIFO off, priority Very High
+ *	- DMA2 stream interrupt of TIM1_CH4 enabled (HAL finishes the
+ *	  transaction in its callback)
+ *	- Channels 2 - 4 are left unused (no output compare pins)
+ *
+ *	The timer period is changed to the slot length while a transaction
+ *	runs and set back to htim->Init.Period after it.
+ *
+ */
+#ifndef ONEWIRE_DMA_H
+#define ONEWIRE_DMA_H
+
+#include "onewire.h"
+
+//
+//	CONFIGURATION
+//
+#define _ONEWIRE_DMA_MAX_BYTES		24 // Longest transaction after the reset, 8 slots per byte
+
+//
+//	Slot timing [us]
+//
+#define ONEWIRE_DMA_SLOT			70 // Bit slot, timer period during a transaction
+#define ONEWIRE_DMA_RELEASE			2  // Write 1 and read slots go high
+#define ONEWIRE_DMA_SAMPLE			12 // Read slot sample point
+#define ONEWIRE_DMA_WRITE0			60 // Write 0 slots go high
+#define ONEWIRE_DMA_RESET_SLOTS		7  // Reset pulse of 7 slots
+#define ONEWIRE_DMA_PRESENCE_SLOT	8  // Presence sampled in the 2nd slot after the reset pulse
+#define ONEWIRE_DMA_RESET_TOTAL		14 // Reset pulse and presence wait
+
+//
+//	FUNCTIONS
+//
+
+//
+// Initialisation - DMA of the timer has to be linked by CubeMX, once per timer
+//
+uint8_t OneWireDma_Init(TIM_HandleTypeDef* htim); // 0 - a DMA request of the timer has no stream
+
+//
+// Transactions - optional reset, write @txlen bytes, then read @rxlen bytes
+// into @rx. @callback gets the presence (1 - a device answered the reset or
+// no reset) and runs from the DMA interrupt.
+//
+uint8_t OneWireDma_Start(OneWire_t* onewire, uint8_t reset, const uint8_t* tx, uint8_t txlen, uint8_t* rx, uint8_t rxlen, void (*callback)(uint8_t presence));
+uint8_t OneWireDma_IsBusy(void);
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * onewire_multi.h
+ *
+ *	The MIT License.
+ *
+ *	Up to 16 separate 1-Wire buses on pins of one GPIO port, bit-banged in
+ *	lock-step. One BSRR write starts the slot on all of them, one IDR read
+ *	samples all of them, so a byte on 8 buses takes as long as on one.
+ *
+ *	Buses are numbered by pin position (GPIO_PIN_3 - bus 3). Per-bus data
+ *	is laid out bus after bus: byte i of bus n is data[n * len + i], so
+ *	buffers have ONEWIRE_MULTI_MAX_BUSES * len bytes. Every pin needs its
+ *	own external pull-up.
+ *
+ */
+#ifndef ONEWIRE_MULTI_H
+#define ONEWIRE_MULTI_H
+
+#include "onewire.h"
+
+#define ONEWIRE_MULTI_MAX_BUSES		16
+
+//
+//	Multi-bus structure
+//
+typedef struct {
+	GPIO_TypeDef* GPIOx;           // Common port
+	uint16_t GPIO_Pins;            // One bus per pin
+	uint32_t SlotEnd;              // Timebase cycle the last slot is over
+} OneWireMulti_t;
+
+//
+//	FUNCTIONS
+//
+
+//
+// Initialisation - pins become open-drain outputs
+//
+void OneWireMulti_Init(OneWireMulti_t* multi, GPIO_TypeDef* GPIOx, uint16_t GPIO_Pins);
+
+//
+// Reset on @pins - returns pins with a presence pulse
+//
+uint16_t OneWireMulti_Reset(OneWireMulti_t* multi, uint16_t pins);
+
+//
+// Writing/Reading on @pins at once
+//
+void OneWireMulti_WriteByte(OneWireMulti_t* multi, uint16_t pins, uint8_t byte); // Same byte on every bus
+void OneWireMulti_WriteBlock(OneWireMulti_t* multi, uint16_t pins, const uint8_t* data, uint8_t len); // Own bytes per bus
+void OneWireMulti_ReadBlock(OneWireMulti_t* multi, uint16_t pins, uint8_t* data, uint8_t len);
+
+#endif
@@ -0,0 +1,82 @@
+/*
+ * onewire_uart.h
+ *
+ *	The MIT License.
+ *
+ *	1-Wire over a USART in half-duplex mode. Every bit slot is one UART
+ *	frame at 115200 baud (0xFF - write 1/read, 0x00 - write 0), reset is
+ *	0xF0 at 9600 baud. The echo received on the same line carries the
+ *	bus state. Multi byte transfers run on DMA.
+ *
+ *	CubeMX setup for the used USART:
+ *	- Mode: Single Wire (Half-Duplex), TX pin as open-drain alternate
+ *	  function with external pullup
+ *	- DMA requests for USART_TX and USART_RX, normal mode, byte width
+ *	- USART global interrupt enabled (HAL finishes DMA TX in the IRQ)
+ *	- HAL_UART_RxCpltCallback has to call OneWireUart_RxCpltCallback
+ *
+ */
+#ifndef ONEWIRE_UART_H
+#define ONEWIRE_UART_H
+
+#include "onewire.h"
+
+//
+//	CONFIGURATION
+//
+#define _ONEWIRE_UART_MAX_BYTES		24 // Longest DMA transaction, one frame per bit - up to 90, its wait deadline is 16 bit [us]
+
+#define ONEWIRE_UART_RESET_BAUD		9600
+#define ONEWIRE_UART_DATA_BAUD		115200
+
+#define ONEWIRE_UART_READY_TIMEOUT	200 // [us] TC interrupt after the last echo, a frame is 87 us
+#define ONEWIRE_UART_FRAME_TIME		87 // [us] One bit slot frame at ONEWIRE_UART_DATA_BAUD
+#define ONEWIRE_UART_FRAME_TIMEOUT	2000 // [us] Longest single frame wait, the reset frame is 1042 us
+
+//
+//	UART bus structure
+//
+typedef struct OneWireUart_t OneWireUart_t;
+
+struct OneWireUart_t {
+	UART_HandleTypeDef* huart;     // Half-duplex USART
+	uint32_t BrrReset;             // BRR for the reset pulse
+	uint32_t BrrData;              // BRR for bit slots
+	volatile uint8_t Busy;         // DMA transaction in progress
+	uint8_t TxLen;                 // Bytes written in the transaction
+	uint8_t RxLen;                 // Bytes read after them
+	uint8_t RxData[_ONEWIRE_UART_MAX_BYTES]; // Decoded read bytes
+	void (*Callback)(OneWireUart_t* uart); // Called from the DMA interrupt when done
+	uint8_t Frames[_ONEWIRE_UART_MAX_BYTES * 8]; // TX frames, overwritten in place by the echo
+};
+
+//
+//	FUNCTIONS
+//
+
+//
+// Initialisation - huart has to be set up by MX_USARTx_UART_Init in half-duplex
+//
+void OneWireUart_Init(OneWireUart_t* uart, UART_HandleTypeDef* huart);
+void OneWire_InitUart(OneWire_t* onewire, OneWireUart_t* uart, UART_HandleTypeDef* huart); // OneWire_t on this USART
+
+extern const OneWire_Ops_t OneWireUart_Ops;
+
+//
+// Blocking bus operations
+//
+uint8_t OneWireUart_Reset(OneWireUart_t* uart);
+uint8_t OneWireUart_Bit(OneWireUart_t* uart, uint8_t bit); // Write 1 to read a bit
+uint8_t OneWireUart_WriteBlock(OneWireUart_t* uart, const uint8_t* data, uint16_t len); // 0 - USART failed
+uint8_t OneWireUart_ReadBlock(OneWireUart_t* uart, uint8_t* data, uint16_t len); // 0 - USART failed, @data all ones
+
+//
+// DMA transactions - write @txlen bytes, then read @rxlen bytes. The
+// USART interrupt has to be able to run while Start waits for the end
+// of the last one (do not start from a handler of higher priority).
+//
+uint8_t OneWireUart_Start(OneWireUart_t* uart, const uint8_t* tx, uint8_t txlen, uint8_t rxlen, void (*callback)(OneWireUart_t* uart));
+uint8_t OneWireUart_IsBusy(OneWireUart_t* uart);
+void OneWireUart_RxCpltCallback(OneWireUart_t* uart, UART_HandleTypeDef* huart);
+
+#endif
@@ -0,0 +1,98 @@
+/*
+ * sim_bus.h
+ *
+ *	The MIT License.
+ *
+ *	Simulated 1-Wire bus for host builds: wired-AND lines with external
+ *	pull-ups, one per attached pin of a GPIO port, master drive taken from
+ *	the simulated GPIO registers and up to SIM_BUS_MAX_DEVICES virtual
+ *	DS18B20 sensors spread over them.
+ *
+ */
+#ifndef SIM_BUS_H
+#define SIM_BUS_H
+
+#include "stm32f4xx_hal.h"
+
+//
+//	CONFIGURATION
+//
+#define SIM_BUS_MAX_DEVICES			64
+#define SIM_BUS_MAX_LINES			16 // One per pin of the attached port
+
+#define SIM_NS_PER_US				1000ULL
+#define SIM_NS_PER_MS				1000000ULL
+
+//
+//	CPU cost model, all in nanoseconds of virtual time (64 MHz core)
+//
+typedef struct
+{
+	uint32_t GpioInit;		// One HAL_GPIO_Init call
+	uint32_t GpioAccess;	// HAL_GPIO_ReadPin/WritePin call
+	uint32_t TimerPoll;		// One iteration of a CNT busy-wait
+	uint32_t CyclePoll;		// One iteration of a CYCCNT busy-wait
+	uint32_t Irq;			// Interrupt entry and exit
+	uint32_t DmaStart;		// HAL_DMA_Start call
+	uint32_t FlashErase;	// Erase of a 128 kB sector, smaller ones take part of it
+	uint32_t FlashProgram;	// One word programmed
+} SimCost_t;
+
+extern SimCost_t SimCost;
+
+//
+//	Bus statistics
+//
+typedef struct
+{
+	uint32_t Resets;			// Reset pulses seen by the devices
+	uint32_t Slots;				// Bit slots started by the master
+	uint32_t WriteViolations;	// Write slots with low time outside 1-15 / 60-120 us
+	uint32_t LateSamples;		// Master sampled a read slot later than 15 us
+	uint32_t Brownouts;			// Parasite devices that lost their supply
+	uint32_t EepromWrites;		// Scratchpad copies finished by the devices
+	uint64_t LowTime;			// Time the master held the line low [ns]
+} SimBusStats_t;
+
+//
+//	FUNCTIONS
+//
+
+//	Clock
+uint64_t	SimClock_Now(void); // Virtual time [ns]
+void		SimClock_Advance(uint64_t ns); // Runs due timer interrupts on the way
+
+//	Ports
+void		SimGpio_Sync(void); // Apply BSRR writes done so far
+
+//	Timer compare interrupt, DMA requests and DMA interrupts
+void		SimTim_SetIrqHandler(void (*handler)(void)); // Stands for TIM1_CC_IRQHandler
+uint8_t		SimTim_NextIrq(uint64_t until, uint64_t* when); // Compare event or DMA request due up to @until
+void		SimTim_Irq(void); // Serve it now
+uint64_t	SimTim_IrqTime(void); // Virtual time spent in the interrupt handlers [ns]
+
+//	USART1 frames and its DMA and USART interrupts
+void		SimUsart_Attach(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin); // TX pin on a bus line
+uint8_t		SimUsart_NextIrq(uint64_t until, uint64_t* when); // Frame step or interrupt due up to @until
+void		SimUsart_Irq(void); // Serve it now
+
+//	Bus
+void		SimBus_Attach(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pins); // Pins the master drives, one line each
+void		SimBus_Update(void); // Re-evaluate master drive after register change
+void		SimBus_RefreshInput(void); // Put the current line level into IDR
+void		SimBus_Sampled(GPIO_TypeDef* GPIOx, uint32_t pins); // Master read the line - check slot timing, NULL port for direct IDR reads
+uint8_t		SimBus_Level(void); // Level of line 0 now
+void		SimBus_GetStats(SimBusStats_t* stats);
+void		SimBus_ResetStats(void);
+
+//	Devices
+int			SimBus_AddDs18b20(uint64_t serial); // Returns device index or -1
+int			SimBus_AddDevice(const uint8_t* ROM); // Any family, DS18B20 behaviour for 0x28
+uint8_t		SimBus_DeviceCount(void);
+void		SimBus_GetROM(int device, uint8_t* ROM);
+void		SimBus_SetTemperature(int device, int16_t raw); // 1/16 degC
+void		SimBus_SetConnected(int device, uint8_t connected);
+void		SimBus_SetParasite(int device, uint8_t parasite); // Powered from the bus line only
+void		SimBus_SetLine(int device, uint8_t line); // Devices start on line 0
+
+#endif
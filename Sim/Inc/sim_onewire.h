@@ -0,0 +1,20 @@
+/*
+ * sim_onewire.h
+ *
+ *	The MIT License.
+ *
+ *	OneWire_t backend driving the simulated bus with ideal Maxim AN126
+ *	standard speed timings and no CPU overhead - the lower bound the real
+ *	backends are compared against.
+ *
+ */
+#ifndef SIM_ONEWIRE_H
+#define SIM_ONEWIRE_H
+
+#include "onewire.h"
+
+extern const OneWire_Ops_t SimOneWire_Ops;
+
+void SimOneWire_Init(OneWire_t* onewire, GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+
+#endif
@@ -0,0 +1,416 @@
+/*
+ * stm32f4xx_hal.h (host simulator)
+ *
+ *	The MIT License.
+ *
+ *	Minimal stand-in for the STM32F4 HAL used when the driver is built
+ *	on the host. Only what the driver sources touch is provided.
+ *	Registers are plain memory; every access that has to move the virtual
+ *	clock or refresh the bus goes through an index expression that calls
+ *	into the simulator, so the driver code compiles unchanged.
+ *
+ */
+#ifndef SIM_STM32F4XX_HAL_H
+#define SIM_STM32F4XX_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define __IO	volatile
+
+//
+//	HAL status
+//
+typedef enum
+{
+	HAL_OK       = 0x00U,
+	HAL_ERROR    = 0x01U,
+	HAL_BUSY     = 0x02U,
+	HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum
+{
+	RESET = 0U,
+	SET = !RESET
+} FlagStatus, ITStatus;
+
+//
+//	GPIO
+//
+//	Reading IDR calls SimGpio_InputAccess() first, which applies pending
+//	BSRR writes and samples the simulated line at the current virtual time.
+//
+typedef struct
+{
+	__IO uint32_t MODER;
+	__IO uint32_t OTYPER;
+	__IO uint32_t OSPEEDR;
+	__IO uint32_t PUPDR;
+	__IO uint32_t Idr[1];
+	__IO uint32_t ODR;
+	__IO uint32_t BSRR;
+	__IO uint32_t LCKR;
+	__IO uint32_t AFR[2];
+} GPIO_TypeDef;
+
+#define IDR		Idr[SimGpio_InputAccess()]
+
+typedef struct
+{
+	uint32_t Pin;
+	uint32_t Mode;
+	uint32_t Pull;
+	uint32_t Speed;
+	uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+typedef enum
+{
+	GPIO_PIN_RESET = 0,
+	GPIO_PIN_SET
+} GPIO_PinState;
+
+#define GPIO_PIN_0				((uint16_t)0x0001)
+#define GPIO_PIN_1				((uint16_t)0x0002)
+#define GPIO_PIN_2				((uint16_t)0x0004)
+#define GPIO_PIN_3				((uint16_t)0x0008)
+#define GPIO_PIN_4				((uint16_t)0x0010)
+#define GPIO_PIN_5				((uint16_t)0x0020)
+#define GPIO_PIN_6				((uint16_t)0x0040)
+#define GPIO_PIN_7				((uint16_t)0x0080)
+#define GPIO_PIN_8				((uint16_t)0x0100)
+#define GPIO_PIN_9				((uint16_t)0x0200)
+#define GPIO_PIN_10				((uint16_t)0x0400)
+#define GPIO_PIN_11				((uint16_t)0x0800)
+#define GPIO_PIN_12				((uint16_t)0x1000)
+#define GPIO_PIN_13				((uint16_t)0x2000)
+#define GPIO_PIN_14				((uint16_t)0x4000)
+#define GPIO_PIN_15				((uint16_t)0x8000)
+
+#define GPIO_MODE_INPUT			0x00000000U
+#define GPIO_MODE_OUTPUT_PP		0x00000001U
+#define GPIO_MODE_OUTPUT_OD		0x00000011U
+
+#define GPIO_NOPULL				0x00000000U
+#define GPIO_PULLUP				0x00000001U
+#define GPIO_PULLDOWN			0x00000002U
+
+#define GPIO_SPEED_FREQ_LOW			0x00000000U
+#define GPIO_SPEED_FREQ_MEDIUM		0x00000001U
+#define GPIO_SPEED_FREQ_HIGH		0x00000002U
+#define GPIO_SPEED_FREQ_VERY_HIGH	0x00000003U
+
+extern GPIO_TypeDef SimGpioA;
+extern GPIO_TypeDef SimGpioB;
+extern GPIO_TypeDef SimGpioC;
+
+#define GPIOA	(&SimGpioA)
+#define GPIOB	(&SimGpioB)
+#define GPIOC	(&SimGpioC)
+
+//
+//	TIM
+//
+//	Reading or writing CNT calls SimTim_Access() first. It applies pending
+//	GPIO writes, moves the virtual clock by one poll of the CPU and returns
+//	index 0, so `while(TIMx->CNT <= us);` really spins on simulated time.
+//	The counter wraps at ARR. Writes to ARR, EGR (UG) and the DMA request
+//	bits of DIER take effect at the next clock step, no time passes before.
+//	SR is an array like CNT, its name belongs to the USART access below.
+//
+typedef struct
+{
+	__IO uint32_t CR1;
+	__IO uint32_t CR2;
+	__IO uint32_t SMCR;
+	__IO uint32_t DIER;
+	__IO uint32_t Sr[1];
+	__IO uint32_t EGR;
+	__IO uint32_t CCMR1;
+	__IO uint32_t CCMR2;
+	__IO uint32_t CCER;
+	__IO uint32_t Cnt[1];
+	__IO uint32_t PSC;
+	__IO uint32_t ARR;
+	__IO uint32_t RCR;
+	__IO uint32_t CCR1;
+	__IO uint32_t CCR2;
+	__IO uint32_t CCR3;
+	__IO uint32_t CCR4;
+} TIM_TypeDef;
+
+#define CNT		Cnt[SimTim_Access()]
+
+#define TIM_SR_CC1IF			0x00000002U
+#define TIM_DIER_CC1IE			0x00000002U
+#define TIM_DIER_UDE			0x00000100U
+#define TIM_DIER_CC2DE			0x00000400U
+#define TIM_DIER_CC3DE			0x00000800U
+#define TIM_DIER_CC4DE			0x00001000U
+#define TIM_CR2_CCDS			0x00000008U
+#define TIM_EGR_UG				0x00000001U
+#define TIM_CCMR1_CC1S			0x00000003U
+#define TIM_CCMR1_OC1M			0x00000070U
+#define TIM_CCMR1_CC2S			0x00000300U
+#define TIM_CCMR1_OC2M			0x00007000U
+#define TIM_CCMR2_CC3S			0x00000003U
+#define TIM_CCMR2_OC3M			0x00000070U
+#define TIM_CCMR2_CC4S			0x00000300U
+#define TIM_CCMR2_OC4M			0x00007000U
+#define TIM_CCER_CC1E			0x00000001U
+#define TIM_CCER_CC2E			0x00000010U
+#define TIM_CCER_CC3E			0x00000100U
+#define TIM_CCER_CC4E			0x00001000U
+
+#define TIM_IT_CC1				TIM_DIER_CC1IE
+#define TIM_FLAG_CC1			TIM_SR_CC1IF
+
+#define TIM_DMA_UPDATE			TIM_DIER_UDE
+#define TIM_DMA_CC2				TIM_DIER_CC2DE
+#define TIM_DMA_CC3				TIM_DIER_CC3DE
+#define TIM_DMA_CC4				TIM_DIER_CC4DE
+
+#define TIM_DMA_ID_UPDATE		0
+#define TIM_DMA_ID_CC1			1
+#define TIM_DMA_ID_CC2			2
+#define TIM_DMA_ID_CC3			3
+#define TIM_DMA_ID_CC4			4
+
+typedef struct
+{
+	uint32_t Prescaler;
+	uint32_t CounterMode;
+	uint32_t Period;
+	uint32_t ClockDivision;
+	uint32_t RepetitionCounter;
+} TIM_Base_InitTypeDef;
+
+//
+//	DWT cycle counter
+//
+//	Reading CYCCNT calls SimDwt_Access() first, which moves the virtual
+//	clock by one poll and puts the cycles of the virtual time in it.
+//
+typedef struct
+{
+	__IO uint32_t CTRL;
+	__IO uint32_t Cyccnt[1];
+} DWT_Type;
+
+typedef struct
+{
+	__IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define CYCCNT		Cyccnt[SimDwt_Access()]
+
+#define DWT_CTRL_CYCCNTENA_Msk			0x00000001U
+#define CoreDebug_DEMCR_TRCENA_Msk		0x01000000U
+
+extern DWT_Type SimDwt;
+extern CoreDebug_Type SimCoreDebug;
+extern uint32_t SystemCoreClock;
+
+#define DWT			(&SimDwt)
+#define CoreDebug	(&SimCoreDebug)
+
+//
+//	DMA
+//
+//	Only the timer requests of TIM1 are modelled. A request moves one half
+//	word between the addresses given to HAL_DMA_Start, the memory side is
+//	incremented. The completion interrupt of HAL_DMA_Start_IT calls
+//	XferCpltCallback like HAL_DMA_IRQHandler does.
+//
+typedef enum
+{
+	HAL_DMA_STATE_RESET = 0x00U,
+	HAL_DMA_STATE_READY = 0x01U,
+	HAL_DMA_STATE_BUSY  = 0x02U
+} HAL_DMA_StateTypeDef;
+
+#define DMA_PERIPH_TO_MEMORY	0x00000000U
+#define DMA_MEMORY_TO_PERIPH	0x00000040U
+
+#define HAL_DMA_ERROR_NO_XFER	0x00000080U
+
+typedef struct
+{
+	uint32_t Direction;
+} DMA_InitTypeDef;
+
+typedef struct __DMA_HandleTypeDef
+{
+	DMA_InitTypeDef Init;
+	__IO HAL_DMA_StateTypeDef State;
+	void (*XferCpltCallback)(struct __DMA_HandleTypeDef *hdma);
+	void (*XferErrorCallback)(struct __DMA_HandleTypeDef *hdma);
+	__IO uint32_t ErrorCode;
+	uintptr_t SimSrc;		// Next source and destination address
+	uintptr_t SimDst;
+	uint32_t SimCount;		// Requests left (NDTR)
+	uint8_t SimIt;			// Started by HAL_DMA_Start_IT
+	uint8_t SimTc;			// Transfer complete interrupt pending
+} DMA_HandleTypeDef;
+
+typedef struct
+{
+	TIM_TypeDef *Instance;
+	TIM_Base_InitTypeDef Init;
+	DMA_HandleTypeDef *hdma[7];
+} TIM_HandleTypeDef;
+
+extern TIM_TypeDef SimTim1;
+
+#define TIM1	(&SimTim1)
+
+//	Compare interrupt - the simulator calls the handler set by
+//	SimTim_SetIrqHandler when the virtual clock passes CCR1. DMA requests
+//	of update and CC2 - CC4 go to the streams in hdma[].
+#define __HAL_TIM_ENABLE_IT(__HANDLE__, __INTERRUPT__)		((__HANDLE__)->Instance->DIER |= (__INTERRUPT__))
+#define __HAL_TIM_DISABLE_IT(__HANDLE__, __INTERRUPT__)		((__HANDLE__)->Instance->DIER &= ~(__INTERRUPT__))
+#define __HAL_TIM_GET_FLAG(__HANDLE__, __FLAG__)			(((__HANDLE__)->Instance->Sr[0] & (__FLAG__)) == (__FLAG__))
+#define __HAL_TIM_GET_IT_SOURCE(__HANDLE__, __INTERRUPT__)	((((__HANDLE__)->Instance->DIER & (__INTERRUPT__)) == (__INTERRUPT__)) ? SET : RESET)
+#define __HAL_TIM_CLEAR_IT(__HANDLE__, __INTERRUPT__)		((__HANDLE__)->Instance->Sr[0] = ~(__INTERRUPT__))
+#define __HAL_TIM_ENABLE_DMA(__HANDLE__, __DMA__)			((__HANDLE__)->Instance->DIER |= (__DMA__))
+#define __HAL_TIM_DISABLE_DMA(__HANDLE__, __DMA__)			((__HANDLE__)->Instance->DIER &= ~(__DMA__))
+
+//
+//	USART
+//
+//	Only USART1 in half-duplex mode is modelled, its TX pin is given to
+//	SimUsart_Attach. Reading or writing SR or DR calls into the simulator
+//	first like CNT does, a byte written to DR goes out at the next access.
+//	Received bytes sit in DR with bit 8 set, so a CPU write is told apart
+//	from them. The DMA calls move bytes between DR and memory per frame,
+//	HAL_UART_RxCpltCallback runs from the simulated DMA interrupt.
+//
+typedef struct
+{
+	__IO uint32_t Sr[1];
+	__IO uint32_t Dr[1];
+	__IO uint32_t BRR;
+	__IO uint32_t CR1;
+	__IO uint32_t CR2;
+	__IO uint32_t CR3;
+	__IO uint32_t GTPR;
+} USART_TypeDef;
+
+#define SR		Sr[SimUsart_Access()]
+#define DR		Dr[SimUsart_DataAccess()]
+
+#define USART_SR_ORE			0x00000008U
+#define USART_SR_RXNE			0x00000020U
+#define USART_SR_TC				0x00000040U
+#define USART_SR_TXE			0x00000080U
+#define USART_CR1_UE			0x00002000U
+
+#define UART_FLAG_ORE			USART_SR_ORE
+#define UART_FLAG_RXNE			USART_SR_RXNE
+#define UART_FLAG_TC			USART_SR_TC
+#define UART_FLAG_TXE			USART_SR_TXE
+
+typedef enum
+{
+	HAL_UART_STATE_RESET   = 0x00U,
+	HAL_UART_STATE_READY   = 0x20U,
+	HAL_UART_STATE_BUSY    = 0x24U,
+	HAL_UART_STATE_BUSY_TX = 0x21U,
+	HAL_UART_STATE_BUSY_RX = 0x22U
+} HAL_UART_StateTypeDef;
+
+typedef struct
+{
+	USART_TypeDef *Instance;
+	__IO HAL_UART_StateTypeDef gState;
+	__IO HAL_UART_StateTypeDef RxState;
+} UART_HandleTypeDef;
+
+extern USART_TypeDef SimUsart1;
+
+#define USART1	(&SimUsart1)
+
+#define UART_BRR_SAMPLING16(_PCLK_, _BAUD_)			(((_PCLK_) + (_BAUD_) / 2U) / (_BAUD_))
+
+#define __HAL_UART_GET_FLAG(__HANDLE__, __FLAG__)	(((__HANDLE__)->Instance->SR & (__FLAG__)) == (__FLAG__))
+#define __HAL_UART_CLEAR_OREFLAG(__HANDLE__)		((__HANDLE__)->Instance->Sr[0] &= ~USART_SR_ORE)
+#define __HAL_UART_ENABLE(__HANDLE__)				((__HANDLE__)->Instance->CR1 |= USART_CR1_UE)
+#define __HAL_UART_DISABLE(__HANDLE__)				((__HANDLE__)->Instance->CR1 &= ~USART_CR1_UE)
+
+//
+//	FLASH
+//
+//	Sectors 0 - 7 of the STM32F401RE are mapped at their real addresses
+//	when the simulator starts, so the driver reads flash through plain
+//	pointers. Programming only clears bits, erase takes the sector time.
+//
+#define FLASH_BASE				0x08000000U
+#define SIM_FLASH_SIZE			0x00080000U // 512 kB
+
+#define FLASH_TYPEERASE_SECTORS		0x00000000U
+#define FLASH_VOLTAGE_RANGE_3		0x00000002U
+#define FLASH_TYPEPROGRAM_WORD		0x00000002U
+
+#define FLASH_SECTOR_0			0U
+#define FLASH_SECTOR_1			1U
+#define FLASH_SECTOR_2			2U
+#define FLASH_SECTOR_3			3U
+#define FLASH_SECTOR_4			4U
+#define FLASH_SECTOR_5			5U
+#define FLASH_SECTOR_6			6U
+#define FLASH_SECTOR_7			7U
+
+typedef struct
+{
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t Sector;
+	uint32_t NbSectors;
+	uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+//
+//	FUNCTIONS
+//
+uint32_t SimTim_Access(void);
+uint32_t SimGpio_InputAccess(void);
+uint32_t SimDwt_Access(void);
+uint32_t SimUsart_Access(void);
+uint32_t SimUsart_DataAccess(void); // Also clears RXNE, like a read of DR
+
+uint32_t __get_PRIMASK(void); // Masks the simulated interrupts, DMA requests go on
+void __set_PRIMASK(uint32_t priMask);
+void __disable_irq(void);
+void __enable_irq(void);
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void HAL_GPIO_TogglePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
+
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim);
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef *htim);
+
+HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef *hdma, uintptr_t SrcAddress, uintptr_t DstAddress, uint32_t DataLength);
+HAL_StatusTypeDef HAL_DMA_Start_IT(DMA_HandleTypeDef *hdma, uintptr_t SrcAddress, uintptr_t DstAddress, uint32_t DataLength);
+HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef *hdma);
+
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef *huart);
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef *huart);
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart); // Weak, the application overrides it
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+
+void HAL_Delay(uint32_t Delay);
+uint32_t HAL_GetTick(void);
+
+#endif
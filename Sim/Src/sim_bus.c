@@ -0,0 +1,784 @@
+/*
+ * sim_bus.c
+ *
+ *	The MIT License.
+ *
+ *	Wired-AND 1-Wire lines with virtual DS18B20 sensors, one line per
+ *	attached pin. Devices only see master edges of their own line: a falling edge starts a slot (a transmitting device may
+ *	hold the line low from there), the rising edge tells how long the master
+ *	held the line - reset, write 1 or write 0.
+ *
+ */
+#include <string.h>
+#include "sim_bus.h"
+
+//
+//	Device timings [ns]
+//
+#define SIM_RESET_MIN			(480 * SIM_NS_PER_US) // Shortest low pulse taken as reset
+#define SIM_PRESENCE_WAIT		(30 * SIM_NS_PER_US)  // tPDHIGH
+#define SIM_PRESENCE_LOW		(120 * SIM_NS_PER_US) // tPDLOW
+#define SIM_WRITE1_MAX			(15 * SIM_NS_PER_US)  // Write 1 must be released before this
+#define SIM_WRITE0_MIN			(60 * SIM_NS_PER_US)  // Write 0 low time
+#define SIM_WRITE0_MAX			(120 * SIM_NS_PER_US)
+#define SIM_DEVICE_SAMPLE		(30 * SIM_NS_PER_US)  // Typical device sampling point
+#define SIM_READ_VALID			(15 * SIM_NS_PER_US)  // Master must sample before this
+#define SIM_TX_HOLD				(30 * SIM_NS_PER_US)  // How long a device holds a '0'
+#define SIM_COPY_TIME			(10 * SIM_NS_PER_MS)
+#define SIM_SUPPLY_DELAY		(20 * SIM_NS_PER_US)  // Command latched, 10 us slot recovery and 10 us to the strong pull-up
+
+//
+//	Parasite supply - how many converting/copying devices one line carries
+//
+#define SIM_STRONG_LOAD			8 // Push-pull pin, about 1.5 mA each
+#define SIM_WEAK_LOAD			1 // Pull-up resistor - one 9 bit conversion, no EEPROM copy
+
+//
+//	Device protocol states
+//
+typedef enum
+{
+	SIM_DEV_IDLE,		// Waits for reset
+	SIM_DEV_ROM_CMD,	// Receiving ROM command
+	SIM_DEV_MATCH,		// Receiving ROM after Match ROM
+	SIM_DEV_SEARCH,		// Search triplets
+	SIM_DEV_FUNC_CMD,	// Receiving function command
+	SIM_DEV_TX,			// Sending TxBuf, then '1'
+	SIM_DEV_RX,			// Receiving Write Scratchpad data
+	SIM_DEV_STATUS		// Read slots return 0 while busy
+} SimDevState_t;
+
+typedef struct
+{
+	uint8_t		ROM[8];
+	uint8_t		Scratchpad[9];
+	uint8_t		Eeprom[3];		// TH, TL, config
+	int16_t		Temperature;	// Physical temperature, 1/16 degC
+	uint8_t		Connected;
+	uint8_t		Line;			// Pin the device hangs on
+	uint8_t		Alarm;			// Last conversion out of TH/TL
+	uint8_t		Parasite;		// Powered from the bus line only
+
+	SimDevState_t State;
+	uint8_t		NextState;		// State after TX is done
+	uint8_t		Shift;			// Received bits
+	uint8_t		BitCount;
+	uint8_t		ByteCount;
+	uint8_t		TxBuf[9];
+	uint8_t		TxBits;
+	uint8_t		TxPos;
+	uint8_t		SearchPhase;
+	uint8_t		SlotTx;			// Device is the sender in the current slot
+	uint8_t		Converting;
+	uint8_t		Copying;		// Scratchpad goes to EEPROM at BusyUntil
+	uint64_t	BusyFrom;
+	uint64_t	BusyUntil;
+	uint64_t	PullFrom;
+	uint64_t	PullUntil;
+} SimDevice_t;
+
+typedef struct
+{
+	uint16_t	Pin;
+	uint8_t		MasterLow;
+	uint64_t	MasterFall;
+	uint8_t		SlotIsRead;		// Some device transmits in this slot
+	uint8_t		SlotSampled;
+	uint8_t		Strong;			// Strong pull-up seen at the last supply check
+} SimLine_t;
+
+//
+//	VARIABLES
+//
+static uint64_t SimTime;
+
+static SimDevice_t Devices[SIM_BUS_MAX_DEVICES];
+static uint8_t DeviceCount;
+
+static GPIO_TypeDef* BusPort;
+static SimLine_t Lines[SIM_BUS_MAX_LINES];
+static uint8_t LineCount;
+
+static SimBusStats_t Stats;
+static uint64_t SupplyChecked;	// Last supply check - register changes count from the check that sees them
+static uint8_t SupplyBusy;		// Some parasite device may be converting or copying
+
+static inline void SimBus_CheckSupplyAll(void);
+
+//
+//	Clock
+//
+uint64_t SimClock_Now(void)
+{
+	return SimTime;
+}
+
+void SimClock_Advance(uint64_t ns)
+{
+	uint64_t until, when, next, start;
+
+	SimGpio_Sync(); // Register writes done so far hold from now on,
+	SimBus_CheckSupplyAll(); // not from the next register access
+	until = SimTime + ns;
+
+	for(;;) // Interrupts stretch the interrupted code, DMA requests and USART frames take no time
+	{
+		uint8_t tim = SimTim_NextIrq(until, &when);
+		uint8_t usart = SimUsart_NextIrq(until, &next) && (!tim || next < when);
+
+		if(!tim && !usart)
+			break;
+
+		SimTime = usart ? next : when;
+		start = SimTime;
+		if(usart)
+			SimUsart_Irq();
+		else
+			SimTim_Irq();
+		until += SimTime - start;
+	}
+
+	SimTime = until;
+}
+
+//
+//	Helpers
+//
+static uint8_t Sim_CRC8(const uint8_t *addr, uint8_t len)
+{
+	uint8_t crc = 0, inbyte, i, mix;
+
+	while (len--)
+	{
+		inbyte = *addr++;
+		for (i = 8; i; i--)
+		{
+			mix = (crc ^ inbyte) & 0x01;
+			crc >>= 1;
+			if (mix)
+				crc ^= 0x8C;
+			inbyte >>= 1;
+		}
+	}
+
+	return crc;
+}
+
+static uint8_t Sim_IsDs18b20(SimDevice_t* dev)
+{
+	return dev->ROM[0] == 0x28;
+}
+
+static uint64_t Sim_ConversionTime(SimDevice_t* dev)
+{
+	uint8_t r = (dev->Scratchpad[4] >> 5) & 3; // 0 - 9 bit ... 3 - 12 bit
+
+	return (750ULL * SIM_NS_PER_MS) >> (3 - r); // 750, 375, 187.5, 93.75 ms
+}
+
+static void Sim_UpdateCRC(SimDevice_t* dev)
+{
+	dev->Scratchpad[8] = Sim_CRC8(dev->Scratchpad, 8);
+}
+
+//
+//	Finish conversion if its time passed
+//
+static inline void Sim_Service(SimDevice_t* dev, uint64_t now)
+{
+	if(!(dev->Converting | dev->Copying) || now < dev->BusyUntil)
+		return;
+
+	if(dev->Converting)
+	{
+		uint8_t r = (dev->Scratchpad[4] >> 5) & 3;
+		int16_t raw = dev->Temperature & ~((1 << (3 - r)) - 1); // Undefined bits are 0 here
+		int8_t th = (int8_t)dev->Scratchpad[2];
+		int8_t tl = (int8_t)dev->Scratchpad[3];
+		int16_t whole = raw >> 4;
+
+		dev->Scratchpad[0] = raw & 0xFF;
+		dev->Scratchpad[1] = (raw >> 8) & 0xFF;
+		Sim_UpdateCRC(dev);
+
+		dev->Alarm = (whole >= th) || (whole <= tl);
+		dev->Converting = 0;
+	}
+
+	if(dev->Copying)
+	{
+		memcpy(dev->Eeprom, &dev->Scratchpad[2], 3);
+		dev->Copying = 0;
+		Stats.EepromWrites++;
+	}
+}
+
+//
+//	Parasite device lost its supply - power-on reset, the operation is lost
+//
+static void Sim_Brownout(SimDevice_t* dev)
+{
+	dev->Scratchpad[0] = 0x50; // 85 degC power-on value
+	dev->Scratchpad[1] = 0x05;
+	memcpy(&dev->Scratchpad[2], dev->Eeprom, 3);
+	Sim_UpdateCRC(dev);
+
+	dev->Converting = 0;
+	dev->Copying = 0;
+	dev->BusyUntil = SimTime;
+	dev->State = SIM_DEV_IDLE;
+	Stats.Brownouts++;
+}
+
+//
+//	Parasite device drew current from the line between @from and now
+//
+static uint8_t Sim_NeedsSupply(SimDevice_t* dev, uint8_t line, uint64_t from)
+{
+	return dev->Line == line && dev->Connected && dev->Parasite && (dev->Converting || dev->Copying) &&
+			SimTime > dev->BusyFrom + SIM_SUPPLY_DELAY && dev->BusyUntil > from;
+}
+
+static void Sim_StartTx(SimDevice_t* dev, const uint8_t* data, uint8_t bits, SimDevState_t next)
+{
+	memcpy(dev->TxBuf, data, (bits + 7) / 8);
+	dev->TxBits = bits;
+	dev->TxPos = 0;
+	dev->NextState = next;
+	dev->State = SIM_DEV_TX;
+}
+
+//
+//	Byte received in ROM/function command state
+//
+static void Sim_RomCommand(SimDevice_t* dev, uint8_t cmd)
+{
+	switch(cmd)
+	{
+		case 0x33: // Read ROM
+			Sim_StartTx(dev, dev->ROM, 64, SIM_DEV_FUNC_CMD);
+		break;
+		case 0x55: // Match ROM
+			dev->State = SIM_DEV_MATCH;
+		break;
+		case 0xCC: // Skip ROM
+			dev->State = SIM_DEV_FUNC_CMD;
+		break;
+		case 0xF0: // Search ROM
+			dev->State = SIM_DEV_SEARCH;
+		break;
+		case 0xEC: // Alarm search
+			dev->State = (dev->Alarm && Sim_IsDs18b20(dev)) ? SIM_DEV_SEARCH : SIM_DEV_IDLE;
+		break;
+		default:
+			dev->State = SIM_DEV_IDLE;
+	}
+	dev->BitCount = 0;
+	dev->SearchPhase = 0;
+}
+
+static void Sim_FunctionCommand(SimDevice_t* dev, uint8_t cmd, uint64_t now)
+{
+	uint8_t bit;
+
+	if(!Sim_IsDs18b20(dev))
+	{
+		dev->State = SIM_DEV_IDLE;
+		return;
+	}
+
+	switch(cmd)
+	{
+		case 0x44: // Convert T
+			dev->Converting = 1;
+			dev->BusyFrom = now;
+			SupplyBusy |= dev->Parasite;
+			dev->BusyUntil = now + Sim_ConversionTime(dev);
+			dev->State = SIM_DEV_STATUS;
+		break;
+		case 0xBE: // Read scratchpad
+			Sim_UpdateCRC(dev);
+			Sim_StartTx(dev, dev->Scratchpad, 72, SIM_DEV_IDLE);
+		break;
+		case 0x4E: // Write scratchpad
+			dev->ByteCount = 0;
+			dev->State = SIM_DEV_RX;
+		break;
+		case 0x48: // Copy scratchpad
+			dev->Copying = 1;
+			dev->BusyFrom = now;
+			SupplyBusy |= dev->Parasite;
+			dev->BusyUntil = now + SIM_COPY_TIME;
+			dev->State = SIM_DEV_STATUS;
+		break;
+		case 0xB8: // Recall EEPROM
+			memcpy(&dev->Scratchpad[2], dev->Eeprom, 3);
+			Sim_UpdateCRC(dev);
+			dev->BusyUntil = now;
+			dev->State = SIM_DEV_STATUS;
+		break;
+		case 0xB4: // Read power supply - parasite-powered devices pull the slot low
+			bit = !dev->Parasite;
+			Sim_StartTx(dev, &bit, 1, SIM_DEV_IDLE);
+		break;
+		default:
+			dev->State = SIM_DEV_IDLE;
+	}
+	dev->BitCount = 0;
+}
+
+//
+//	Master pulled the line low - slot start
+//
+static void Sim_OnFall(SimDevice_t* dev, uint64_t now)
+{
+	uint8_t bit;
+
+	switch(dev->State)
+	{
+		case SIM_DEV_TX:
+			bit = 1;
+			if(dev->TxPos < dev->TxBits)
+				bit = (dev->TxBuf[dev->TxPos >> 3] >> (dev->TxPos & 7)) & 1;
+			dev->TxPos++;
+		break;
+
+		case SIM_DEV_SEARCH:
+			if(dev->SearchPhase == 2)
+				return; // Direction bit is received on the rising edge
+			bit = (dev->ROM[dev->BitCount >> 3] >> (dev->BitCount & 7)) & 1;
+			if(dev->SearchPhase == 1)
+				bit = !bit;
+		break;
+
+		case SIM_DEV_STATUS:
+			bit = dev->Parasite || (now >= dev->BusyUntil); // Parasite devices cannot pull the line while busy
+		break;
+
+		default:
+			return;
+	}
+
+	Lines[dev->Line].SlotIsRead = 1;
+	dev->SlotTx = 1;
+
+	if(!bit)
+	{
+		dev->PullFrom = now;
+		dev->PullUntil = now + SIM_TX_HOLD;
+	}
+}
+
+//
+//	Master released the line after @low ns
+//
+static void Sim_OnRise(SimDevice_t* dev, uint64_t now, uint64_t low)
+{
+	uint8_t bit;
+
+	if(low >= SIM_RESET_MIN)
+	{
+		dev->SlotTx = 0;
+		dev->State = SIM_DEV_ROM_CMD;
+		dev->BitCount = 0;
+		dev->Shift = 0;
+		dev->PullFrom = now + SIM_PRESENCE_WAIT;
+		dev->PullUntil = dev->PullFrom + SIM_PRESENCE_LOW;
+		return;
+	}
+
+	if(dev->SlotTx) // End of a slot the device was sending in
+	{
+		dev->SlotTx = 0;
+		if(dev->State == SIM_DEV_SEARCH)
+			dev->SearchPhase++;
+		else if(dev->State == SIM_DEV_TX && dev->TxPos >= dev->TxBits && dev->NextState != SIM_DEV_IDLE)
+			dev->State = dev->NextState;
+		return;
+	}
+
+	if(dev->State == SIM_DEV_IDLE || dev->State == SIM_DEV_TX || dev->State == SIM_DEV_STATUS)
+		return;
+
+	bit = (low < SIM_DEVICE_SAMPLE); // Line is already high when the device samples
+
+	switch(dev->State)
+	{
+		case SIM_DEV_ROM_CMD:
+		case SIM_DEV_FUNC_CMD:
+		case SIM_DEV_RX:
+			dev->Shift >>= 1;
+			if(bit)
+				dev->Shift |= 0x80;
+			if(++dev->BitCount < 8)
+				return;
+			dev->BitCount = 0;
+
+			if(dev->State == SIM_DEV_ROM_CMD)
+			{
+				Sim_RomCommand(dev, dev->Shift);
+			}
+			else if(dev->State == SIM_DEV_FUNC_CMD)
+			{
+				Sim_FunctionCommand(dev, dev->Shift, now);
+			}
+			else
+			{
+				if(dev->ByteCount == 2)
+					dev->Shift = (dev->Shift & 0x60) | 0x1F; // Only R1/R0 are writable
+				dev->Scratchpad[2 + dev->ByteCount] = dev->Shift;
+				Sim_UpdateCRC(dev);
+				if(++dev->ByteCount == 3)
+					dev->State = SIM_DEV_IDLE;
+			}
+		break;
+
+		case SIM_DEV_MATCH:
+			if(bit != ((dev->ROM[dev->BitCount >> 3] >> (dev->BitCount & 7)) & 1))
+			{
+				dev->State = SIM_DEV_IDLE;
+				return;
+			}
+			if(++dev->BitCount == 64)
+			{
+				dev->BitCount = 0;
+				dev->State = SIM_DEV_FUNC_CMD;
+			}
+		break;
+
+		case SIM_DEV_SEARCH:
+			dev->SearchPhase = 0;
+			if(bit != ((dev->ROM[dev->BitCount >> 3] >> (dev->BitCount & 7)) & 1))
+			{
+				dev->State = SIM_DEV_IDLE; // Master went the other way
+				return;
+			}
+			if(++dev->BitCount == 64)
+			{
+				dev->BitCount = 0;
+				dev->State = SIM_DEV_FUNC_CMD;
+			}
+		break;
+
+		default:
+		break;
+	}
+}
+
+//
+//	Bus
+//
+void SimBus_Attach(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pins)
+{
+	uint8_t pos;
+
+	BusPort = GPIOx;
+	LineCount = 0;
+
+	for(pos = 0; pos < 16; pos++) // Every pin is a separate line, lowest pin is line 0
+	{
+		if(!(GPIO_Pins & (1U << pos)))
+			continue;
+
+		memset(&Lines[LineCount], 0, sizeof(SimLine_t));
+		Lines[LineCount++].Pin = 1U << pos;
+	}
+}
+
+static uint8_t SimBus_MasterLow(SimLine_t* line)
+{
+	uint32_t pos = 0;
+
+	while(!(line->Pin & (1U << pos)))
+		pos++;
+
+	if(((BusPort->MODER >> (pos * 2)) & 3U) != 1U) // Not an output
+		return 0;
+
+	return !(BusPort->ODR & line->Pin);
+}
+
+//
+//	Master drives the line high push-pull - strong pull-up
+//
+static uint8_t SimBus_StrongPullup(SimLine_t* line)
+{
+	uint32_t pos = 0;
+
+	while(!(line->Pin & (1U << pos)))
+		pos++;
+
+	return ((BusPort->MODER >> (pos * 2)) & 3U) == 1U && !(BusPort->OTYPER & line->Pin) && (BusPort->ODR & line->Pin);
+}
+
+//
+//	Parasite devices converting or copying get their current from the line.
+//	The drive seen at the last check held until now, so a conversion that
+//	ended in between is judged before it is finished.
+//
+static void SimBus_CheckSupply(uint8_t line)
+{
+	uint8_t i, load = 0, heavy = 0;
+
+	for(i = 0; i < DeviceCount; i++)
+	{
+		if(!Sim_NeedsSupply(&Devices[i], line, SupplyChecked))
+			continue;
+
+		load++;
+		if(Devices[i].Copying || ((Devices[i].Scratchpad[4] >> 5) & 3))
+			heavy = 1;
+	}
+
+	if(load && !(Lines[line].Strong ? load <= SIM_STRONG_LOAD : (load <= SIM_WEAK_LOAD && !heavy)))
+	{
+		for(i = 0; i < DeviceCount; i++)
+		{
+			if(Sim_NeedsSupply(&Devices[i], line, SupplyChecked))
+				Sim_Brownout(&Devices[i]);
+		}
+	}
+
+	Lines[line].Strong = SimBus_StrongPullup(&Lines[line]);
+}
+
+static void SimBus_CheckSupplyBusy(void)
+{
+	uint8_t i;
+
+	for(i = 0; i < LineCount; i++)
+		SimBus_CheckSupply(i);
+
+	SupplyBusy = 0;
+	for(i = 0; i < DeviceCount; i++)
+	{
+		if(Devices[i].Parasite && (Devices[i].Converting || Devices[i].Copying) && Devices[i].BusyUntil > SimTime)
+			SupplyBusy = 1;
+	}
+}
+
+static inline void SimBus_CheckSupplyAll(void) // Runs on every clock step - cheap without parasite work
+{
+	if(SupplyBusy)
+		SimBus_CheckSupplyBusy();
+
+	SupplyChecked = SimTime;
+}
+
+static uint8_t SimBus_LineLevel(uint8_t line)
+{
+	uint8_t i;
+
+	if(Lines[line].MasterLow)
+		return 0;
+
+	for(i = 0; i < DeviceCount; i++)
+	{
+		SimDevice_t* dev = &Devices[i];
+
+		if(dev->Line == line && dev->Connected && dev->PullFrom <= SimTime && SimTime < dev->PullUntil)
+			return 0;
+	}
+
+	return 1;
+}
+
+uint8_t SimBus_Level(void)
+{
+	return LineCount ? SimBus_LineLevel(0) : 1;
+}
+
+void SimBus_RefreshInput(void)
+{
+	uint8_t i;
+
+	SimBus_CheckSupplyAll(); // Before conversions end
+
+	for(i = 0; i < DeviceCount; i++)
+		Sim_Service(&Devices[i], SimTime);
+
+	for(i = 0; i < LineCount; i++)
+	{
+		if(SimBus_LineLevel(i))
+			BusPort->Idr[0] |= Lines[i].Pin;
+		else
+			BusPort->Idr[0] &= ~(uint32_t)Lines[i].Pin;
+	}
+}
+
+static void SimBus_UpdateLine(uint8_t index)
+{
+	SimLine_t* line = &Lines[index];
+	uint8_t low = SimBus_MasterLow(line);
+	uint8_t i;
+
+	if(low && !line->MasterLow)
+	{
+		line->MasterFall = SimTime;
+		line->SlotIsRead = 0;
+		line->SlotSampled = 0;
+		Stats.Slots++;
+
+		for(i = 0; i < DeviceCount; i++)
+		{
+			Sim_Service(&Devices[i], SimTime);
+			if(Devices[i].Line == index && Devices[i].Connected && Devices[i].Parasite &&
+					(Devices[i].Converting || Devices[i].Copying))
+				Sim_Brownout(&Devices[i]); // Line low takes the supply away
+			if(Devices[i].Line == index && Devices[i].Connected)
+				Sim_OnFall(&Devices[i], SimTime);
+		}
+	}
+	else if(!low && line->MasterLow)
+	{
+		uint64_t duration = SimTime - line->MasterFall;
+
+		Stats.LowTime += duration;
+
+		if(duration >= SIM_RESET_MIN)
+		{
+			Stats.Slots--; // Reset is not a slot
+			Stats.Resets++;
+			line->SlotIsRead = 0;
+		}
+		else if(!line->SlotIsRead && ((duration >= SIM_WRITE1_MAX && duration < SIM_WRITE0_MIN) || duration > SIM_WRITE0_MAX))
+		{
+			Stats.WriteViolations++;
+		}
+
+		for(i = 0; i < DeviceCount; i++)
+		{
+			if(Devices[i].Line == index && Devices[i].Connected)
+				Sim_OnRise(&Devices[i], SimTime, duration);
+		}
+	}
+
+	line->MasterLow = low;
+}
+
+void SimBus_Update(void)
+{
+	uint8_t i;
+
+	SimBus_CheckSupplyAll();
+
+	for(i = 0; i < LineCount; i++)
+		SimBus_UpdateLine(i);
+
+	SimBus_RefreshInput();
+}
+
+void SimBus_Sampled(GPIO_TypeDef* GPIOx, uint32_t pins)
+{
+	uint8_t i;
+
+	if(GPIOx && GPIOx != BusPort)
+		return;
+
+	for(i = 0; i < LineCount; i++)
+	{
+		SimLine_t* line = &Lines[i];
+
+		if(GPIOx && !(pins & line->Pin)) // NULL - direct IDR read of all lines
+			continue;
+
+		if(line->SlotIsRead && !line->SlotSampled && !line->MasterLow)
+		{
+			line->SlotSampled = 1;
+			if(SimTime - line->MasterFall > SIM_READ_VALID)
+				Stats.LateSamples++;
+		}
+	}
+}
+
+void SimBus_GetStats(SimBusStats_t* stats)
+{
+	*stats = Stats;
+}
+
+void SimBus_ResetStats(void)
+{
+	memset(&Stats, 0, sizeof(Stats));
+}
+
+//
+//	Devices
+//
+int SimBus_AddDevice(const uint8_t* ROM)
+{
+	SimDevice_t* dev;
+
+	if(DeviceCount >= SIM_BUS_MAX_DEVICES)
+		return -1;
+
+	dev = &Devices[DeviceCount];
+	memset(dev, 0, sizeof(*dev));
+	memcpy(dev->ROM, ROM, 8);
+
+	dev->Eeprom[0] = 75;	// TH - factory default
+	dev->Eeprom[1] = 70;	// TL
+	dev->Eeprom[2] = 0x7F;	// 12 bit
+
+	dev->Scratchpad[0] = 0x50; // 85 degC power-on value
+	dev->Scratchpad[1] = 0x05;
+	memcpy(&dev->Scratchpad[2], dev->Eeprom, 3);
+	dev->Scratchpad[5] = 0xFF;
+	dev->Scratchpad[6] = 0x0C;
+	dev->Scratchpad[7] = 0x10;
+	Sim_UpdateCRC(dev);
+
+	dev->Temperature = 25 * 16;
+	dev->Connected = 1;
+	dev->State = SIM_DEV_IDLE;
+
+	return DeviceCount++;
+}
+
+int SimBus_AddDs18b20(uint64_t serial)
+{
+	uint8_t ROM[8];
+	uint8_t i;
+
+	ROM[0] = 0x28;
+	for(i = 1; i < 7; i++)
+	{
+		ROM[i] = serial & 0xFF;
+		serial >>= 8;
+	}
+	ROM[7] = Sim_CRC8(ROM, 7);
+
+	return SimBus_AddDevice(ROM);
+}
+
+uint8_t SimBus_DeviceCount(void)
+{
+	return DeviceCount;
+}
+
+void SimBus_GetROM(int device, uint8_t* ROM)
+{
+	memcpy(ROM, Devices[device].ROM, 8);
+}
+
+void SimBus_SetTemperature(int device, int16_t raw)
+{
+	Devices[device].Temperature = raw;
+}
+
+void SimBus_SetLine(int device, uint8_t line)
+{
+	Devices[device].Line = line;
+	Devices[device].State = SIM_DEV_IDLE;
+}
+
+void SimBus_SetParasite(int device, uint8_t parasite)
+{
+	Devices[device].Parasite = parasite;
+}
+
+void SimBus_SetConnected(int device, uint8_t connected)
+{
+	Devices[device].Connected = connected;
+	Devices[device].State = SIM_DEV_IDLE;
+	Devices[device].PullUntil = 0;
+}
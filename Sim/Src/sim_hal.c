@@ -0,0 +1,940 @@
+/*
+ * sim_hal.c
+ *
+ *	The MIT License.
+ *
+ *	Simulated GPIO/TIM registers and the HAL calls the driver uses.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "stm32f4xx_hal.h"
+#include "sim_bus.h"
+
+//
+//	VARIABLES
+//
+GPIO_TypeDef SimGpioA;
+GPIO_TypeDef SimGpioB;
+GPIO_TypeDef SimGpioC;
+
+TIM_TypeDef SimTim1 = { .ARR = 0xFFFF };
+
+DMA_HandleTypeDef hdma_tim1_up = { .Init.Direction = DMA_MEMORY_TO_PERIPH, .State = HAL_DMA_STATE_READY };
+DMA_HandleTypeDef hdma_tim1_ch2 = { .Init.Direction = DMA_MEMORY_TO_PERIPH, .State = HAL_DMA_STATE_READY };
+DMA_HandleTypeDef hdma_tim1_ch3 = { .Init.Direction = DMA_PERIPH_TO_MEMORY, .State = HAL_DMA_STATE_READY };
+DMA_HandleTypeDef hdma_tim1_ch4 = { .Init.Direction = DMA_MEMORY_TO_PERIPH, .State = HAL_DMA_STATE_READY };
+
+TIM_HandleTypeDef htim1 = // MX_TIM1_Init with the DMA requests linked
+{
+	.Instance = &SimTim1,
+	.Init.Prescaler = 63,
+	.Init.Period = 65535,
+	.hdma = {
+		[TIM_DMA_ID_UPDATE] = &hdma_tim1_up,
+		[TIM_DMA_ID_CC2] = &hdma_tim1_ch2,
+		[TIM_DMA_ID_CC3] = &hdma_tim1_ch3,
+		[TIM_DMA_ID_CC4] = &hdma_tim1_ch4,
+	},
+};
+
+USART_TypeDef SimUsart1 = { .Sr = { USART_SR_TXE | USART_SR_TC }, .Dr = { 0x100 } };
+
+DWT_Type SimDwt;
+CoreDebug_Type SimCoreDebug;
+uint32_t SystemCoreClock = 64000000;
+
+static GPIO_TypeDef* const SimPorts[] = { &SimGpioA, &SimGpioB, &SimGpioC };
+
+#define SIM_TIM_TICK_NS		1000ULL // TIM1 prescaler 63 at 64 MHz - 1 us per tick
+
+static uint64_t TimOrigin;   // Virtual time when CNT was 0
+static uint32_t TimShadow;   // Last value placed in CNT by the simulator
+static uint32_t TimPeriod = 0x10000; // ARR + 1 the counter runs with
+static uint32_t TimDier;     // DIER seen by the last sync
+static uint64_t TimServed;   // DMA requests up to this tick are served
+static uint8_t TimUpdate;    // UG written - update request due now
+
+static void (*TimIrqHandler)(void);
+static uint8_t TimInIrq;
+static uint64_t TimIrqTime;
+static uint32_t Primask;
+
+//
+//	Timer DMA requests - update and CC2 - CC4
+//
+#define SIM_TIM_DMA_REQUESTS	4
+
+static const uint32_t TimDmaEnable[SIM_TIM_DMA_REQUESTS] = { TIM_DIER_UDE, TIM_DIER_CC2DE, TIM_DIER_CC3DE, TIM_DIER_CC4DE };
+static const uint8_t TimDmaId[SIM_TIM_DMA_REQUESTS] = { TIM_DMA_ID_UPDATE, TIM_DMA_ID_CC2, TIM_DMA_ID_CC3, TIM_DMA_ID_CC4 };
+
+typedef enum
+{
+	SIM_TIM_EVENT_DMA,		// DMA request, no CPU time
+	SIM_TIM_EVENT_DMA_IRQ,	// Transfer complete interrupt
+	SIM_TIM_EVENT_CC1,		// Compare interrupt
+} SimTimEvent_t;
+
+static SimTimEvent_t TimEvent;
+static DMA_HandleTypeDef* TimDmaIrq;
+
+SimCost_t SimCost =
+{
+	.GpioInit = 2500,
+	.GpioAccess = 150,
+	.TimerPoll = 100,
+	.CyclePoll = 50,
+	.Irq = 400,
+	.DmaStart = 1500,
+	.FlashErase = 1000000000, // Typical 128 kB sector erase at x32 parallelism
+	.FlashProgram = 16000,
+};
+
+static const uint32_t SimFlashSector[9] = // Sector start offsets of the STM32F401RE
+{
+	0x00000, 0x04000, 0x08000, 0x0C000, 0x10000, 0x20000, 0x40000, 0x60000, 0x80000
+};
+
+static uint8_t FlashLocked = 1;
+
+//
+//	USART1 in half-duplex mode - the frame runs in half bit steps, the
+//	line is driven on even steps and sampled in the middle of the bit
+//
+#define SIM_USART_PCLK			64000000ULL
+#define SIM_USART_STEPS			20 // Start, 8 data and stop bit
+
+typedef enum
+{
+	SIM_USART_EVENT_STEP,	// Next half bit of the frame, no CPU time
+	SIM_USART_EVENT_RX_IRQ,	// RX DMA stream complete
+	SIM_USART_EVENT_TC_IRQ,	// Last TX DMA frame out
+} SimUsartEvent_t;
+
+static struct
+{
+	GPIO_TypeDef* Port;		// TX pin on the bus
+	uint16_t Pin;
+	UART_HandleTypeDef* Handle; // Handle of the running DMA transfers
+	uint32_t Dr;			// Last value placed in DR by the simulator
+	uint8_t Tdr;			// Byte waiting in the transmit data register
+	uint8_t TdrFull;
+	uint8_t Shifting;		// Frame on the line
+	uint16_t Frame;			// Its bits, start bit first
+	uint8_t Echo;			// Bits sampled so far
+	uint8_t Step;			// Next half bit step
+	uint64_t Start;			// Time of the start bit edge
+	uint64_t Bit;			// Bit time of this frame [ns]
+	uint8_t* TxData;		// DMA streams
+	uint16_t TxCount;
+	uint8_t TxDone;			// TX stream done, TC interrupt ends the transfer
+	uint8_t* RxData;
+	uint16_t RxCount;
+	uint8_t RxDone;			// RX stream done, interrupt pending
+	uint8_t InIrq;
+	SimUsartEvent_t Event;
+} Usart = { .Dr = 0x100 };
+
+//
+//	Apply BSRR writes and refresh IDR of all ports
+//
+void SimGpio_Sync(void)
+{
+	uint8_t i;
+	uint8_t changed = 0;
+
+	for(i = 0; i < sizeof(SimPorts) / sizeof(SimPorts[0]); i++)
+	{
+		GPIO_TypeDef* port = SimPorts[i];
+
+		if(port->BSRR)
+		{
+			port->ODR &= ~(port->BSRR >> 16); // Reset bits first,
+			port->ODR |= port->BSRR & 0xFFFF; // set bits win like on silicon
+			port->BSRR = 0;
+			changed = 1;
+		}
+	}
+
+	for(i = 0; i < sizeof(SimPorts) / sizeof(SimPorts[0]); i++)
+		SimPorts[i]->Idr[0] = SimPorts[i]->ODR;
+
+	if(changed)
+		SimBus_Update(); // Also refreshes the bus pin in IDR
+	else
+		SimBus_RefreshInput();
+}
+
+//
+//	Timer register changes since the last look
+//
+static uint64_t SimTim_Tick(void)
+{
+	return (SimClock_Now() - TimOrigin) / SIM_TIM_TICK_NS;
+}
+
+static void SimTim_Sync(void)
+{
+	uint64_t tick;
+	uint32_t period = (SimTim1.ARR & 0xFFFF) + 1;
+
+	if(SimTim1.Cnt[0] != TimShadow) // Counter was written since the last access
+	{
+		TimOrigin = SimClock_Now() - (uint64_t)SimTim1.Cnt[0] * SIM_TIM_TICK_NS;
+		TimShadow = SimTim1.Cnt[0];
+		TimServed = SimTim_Tick();
+	}
+
+	if(period != TimPeriod) // Edges stay where they are, the count goes on from the same value
+	{
+		tick = SimTim_Tick();
+		TimOrigin += (tick - tick % TimPeriod) * SIM_TIM_TICK_NS;
+		TimServed -= tick - tick % TimPeriod;
+		TimPeriod = period;
+	}
+
+	if(SimTim1.EGR & TIM_EGR_UG) // Counter to 0 now, update request with it
+	{
+		SimTim1.EGR = 0;
+		TimOrigin = SimClock_Now();
+		TimShadow = 0;
+		SimTim1.Cnt[0] = 0;
+		TimServed = 0;
+		TimUpdate = 1;
+	}
+
+	if((SimTim1.DIER & ~TimDier) & (TIM_DIER_UDE | TIM_DIER_CC2DE | TIM_DIER_CC3DE | TIM_DIER_CC4DE))
+		TimServed = SimTim_Tick(); // Requests just enabled - earlier edges do not count
+
+	TimDier = SimTim1.DIER;
+}
+
+//
+//	Timer counter access
+//
+uint32_t SimTim_Access(void)
+{
+	SimGpio_Sync(); // Register writes done before this access happen now
+	SimTim_Sync();
+
+	SimClock_Advance(SimCost.TimerPoll);
+
+	TimShadow = (uint32_t)(SimTim_Tick() % TimPeriod);
+	SimTim1.Cnt[0] = TimShadow;
+
+	return 0;
+}
+
+//
+//	Cycle counter access
+//
+uint32_t SimDwt_Access(void)
+{
+	SimGpio_Sync();
+	SimClock_Advance(SimCost.CyclePoll);
+
+	if((SimDwt.CTRL & DWT_CTRL_CYCCNTENA_Msk) && (SimCoreDebug.DEMCR & CoreDebug_DEMCR_TRCENA_Msk))
+		SimDwt.Cyccnt[0] = (uint32_t)(SimClock_Now() * (SystemCoreClock / 1000000) / SIM_NS_PER_US);
+
+	return 0;
+}
+
+//
+//	DMA requests
+//
+static DMA_HandleTypeDef* SimDma_Stream(uint8_t request)
+{
+	DMA_HandleTypeDef* hdma = htim1.hdma[TimDmaId[request]];
+
+	if(!(SimTim1.DIER & TimDmaEnable[request]) || !hdma || hdma->State != HAL_DMA_STATE_BUSY || !hdma->SimCount)
+		return NULL;
+
+	return hdma;
+}
+
+static uint32_t SimDma_Compare(uint8_t request)
+{
+	switch(request)
+	{
+	case 1: return SimTim1.CCR2;
+	case 2: return SimTim1.CCR3;
+	case 3: return SimTim1.CCR4;
+	default: return 0; // Update - the counter turns over to 0
+	}
+}
+
+static uint8_t SimDma_Next(uint64_t* tick)
+{
+	uint64_t next, base = TimServed + 1;
+	uint32_t compare;
+	uint8_t i, found = 0;
+
+	for(i = 0; i < SIM_TIM_DMA_REQUESTS; i++)
+	{
+		compare = SimDma_Compare(i);
+		if(!SimDma_Stream(i) || compare >= TimPeriod)
+			continue;
+
+		next = base + (compare + TimPeriod - base % TimPeriod) % TimPeriod;
+		if(!found || next < *tick)
+			*tick = next;
+		found = 1;
+	}
+
+	return found;
+}
+
+static void SimDma_Transfer(DMA_HandleTypeDef* hdma)
+{
+	SimGpio_Sync(); // CPU writes done so far come first
+
+	if(hdma->Init.Direction == DMA_PERIPH_TO_MEMORY)
+	{
+		SimBus_Sampled(NULL, 0);
+		*(uint16_t*)hdma->SimDst = *(uint16_t*)hdma->SimSrc;
+		hdma->SimDst += 2;
+	}
+	else
+	{
+		*(uint16_t*)hdma->SimDst = *(uint16_t*)hdma->SimSrc;
+		hdma->SimSrc += 2;
+		SimGpio_Sync();
+	}
+
+	if(!--hdma->SimCount && hdma->SimIt)
+		hdma->SimTc = 1;
+}
+
+//
+//	Serve the requests due at the current tick edge
+//
+static void SimDma_Serve(void)
+{
+	uint64_t tick;
+	uint8_t i;
+
+	if(TimUpdate)
+	{
+		TimUpdate = 0;
+		if(SimDma_Stream(0))
+			SimDma_Transfer(SimDma_Stream(0));
+	}
+
+	if(!SimDma_Next(&tick) || TimOrigin + tick * SIM_TIM_TICK_NS > SimClock_Now())
+		return;
+
+	for(i = 0; i < SIM_TIM_DMA_REQUESTS; i++) // All requests of this edge, stream priority order
+	{
+		if(SimDma_Stream(i) && SimDma_Compare(i) < TimPeriod && tick % TimPeriod == SimDma_Compare(i))
+			SimDma_Transfer(SimDma_Stream(i));
+	}
+
+	TimServed = tick;
+}
+
+//
+//	Compare interrupt
+//
+void SimTim_SetIrqHandler(void (*handler)(void))
+{
+	TimIrqHandler = handler;
+}
+
+uint8_t SimTim_NextIrq(uint64_t until, uint64_t* when)
+{
+	uint64_t tick, next;
+	uint8_t i;
+
+	SimTim_Sync();
+
+	*when = UINT64_MAX;
+
+	if(!(SimTim1.CR1 & 1))
+		return 0;
+
+	if(TimUpdate || (SimDma_Next(&next) && TimOrigin + next * SIM_TIM_TICK_NS < *when))
+	{
+		*when = TimUpdate ? SimClock_Now() : TimOrigin + next * SIM_TIM_TICK_NS;
+		TimEvent = SIM_TIM_EVENT_DMA;
+	}
+
+	if(TimInIrq || Primask) // DMA runs on, interrupts wait
+		return *when <= until;
+
+	for(i = 0; i < SIM_TIM_DMA_REQUESTS; i++)
+	{
+		DMA_HandleTypeDef* hdma = htim1.hdma[TimDmaId[i]];
+
+		if(hdma && hdma->SimTc && SimClock_Now() < *when)
+		{
+			*when = SimClock_Now();
+			TimEvent = SIM_TIM_EVENT_DMA_IRQ;
+			TimDmaIrq = hdma;
+		}
+	}
+
+	if(!TimIrqHandler || !(SimTim1.DIER & TIM_DIER_CC1IE))
+		return *when <= until;
+
+	if(SimTim1.Sr[0] & TIM_SR_CC1IF) // Flag left set - interrupt pending already
+		next = SimClock_Now();
+	else
+	{
+		tick = SimTim_Tick();
+		next = tick + (SimTim1.CCR1 + TimPeriod - tick % TimPeriod) % TimPeriod; // Counter reaches CCR1 on a tick edge
+		if(next == tick)
+			next += TimPeriod;
+		next = TimOrigin + next * SIM_TIM_TICK_NS;
+	}
+
+	if(next < *when)
+	{
+		*when = next;
+		TimEvent = SIM_TIM_EVENT_CC1;
+	}
+
+	return *when <= until;
+}
+
+void SimTim_Irq(void)
+{
+	uint64_t start = SimClock_Now();
+
+	if(TimEvent == SIM_TIM_EVENT_DMA)
+	{
+		SimDma_Serve();
+		return;
+	}
+
+	TimInIrq = 1;
+	SimClock_Advance(SimCost.Irq);
+
+	if(TimEvent == SIM_TIM_EVENT_DMA_IRQ) // HAL_DMA_IRQHandler - normal mode stream is done
+	{
+		TimDmaIrq->SimTc = 0;
+		TimDmaIrq->State = HAL_DMA_STATE_READY;
+		if(TimDmaIrq->XferCpltCallback)
+			TimDmaIrq->XferCpltCallback(TimDmaIrq);
+	}
+	else
+	{
+		SimTim1.Sr[0] |= TIM_SR_CC1IF;
+		TimIrqHandler();
+	}
+
+	SimGpio_Sync(); // Writes done on the way out
+	TimInIrq = 0;
+
+	TimIrqTime += SimClock_Now() - start;
+}
+
+uint64_t SimTim_IrqTime(void)
+{
+	return TimIrqTime;
+}
+
+//
+//	Interrupt mask
+//
+uint32_t __get_PRIMASK(void)
+{
+	return Primask;
+}
+
+void __set_PRIMASK(uint32_t priMask)
+{
+	Primask = priMask & 1;
+}
+
+void __disable_irq(void)
+{
+	Primask = 1;
+}
+
+void __enable_irq(void)
+{
+	Primask = 0;
+}
+
+//
+//	Direct IDR read
+//
+uint32_t SimGpio_InputAccess(void)
+{
+	SimGpio_Sync();
+	SimBus_Sampled(NULL, 0); // Port is unknown here - taken as a bus read
+
+	return 0;
+}
+
+//
+//	GPIO
+//
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init)
+{
+	uint32_t pos;
+
+	SimGpio_Sync();
+	SimClock_Advance(SimCost.GpioInit);
+
+	for(pos = 0; pos < 16; pos++)
+	{
+		if(!(GPIO_Init->Pin & (1U << pos)))
+			continue;
+
+		GPIOx->MODER &= ~(3U << (pos * 2));
+		GPIOx->MODER |= (GPIO_Init->Mode & 3U) << (pos * 2);
+		GPIOx->OTYPER &= ~(1U << pos);
+		GPIOx->OTYPER |= ((GPIO_Init->Mode >> 4) & 1U) << pos;
+	}
+
+	SimBus_Update();
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+	SimGpio_Sync();
+	SimClock_Advance(SimCost.GpioAccess); // IDR is read at the end of the call
+	SimBus_RefreshInput();
+
+	SimBus_Sampled(GPIOx, GPIO_Pin);
+
+	return (GPIOx->Idr[0] & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	if(PinState != GPIO_PIN_RESET)
+		GPIOx->BSRR = GPIO_Pin;
+	else
+		GPIOx->BSRR = (uint32_t)GPIO_Pin << 16;
+
+	SimGpio_Sync();
+	SimClock_Advance(SimCost.GpioAccess);
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+	SimGpio_Sync();
+	GPIOx->ODR ^= GPIO_Pin;
+	GPIOx->Idr[0] = GPIOx->ODR;
+	SimBus_Update();
+	SimClock_Advance(SimCost.GpioAccess);
+}
+
+//
+//	TIM
+//
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef *htim)
+{
+	htim->Instance->CR1 |= 1; // Counter runs from the virtual clock
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef *htim)
+{
+	htim->Instance->CR1 &= ~1U;
+	return HAL_OK;
+}
+
+//
+//	DMA
+//
+static HAL_StatusTypeDef SimDma_Start(DMA_HandleTypeDef *hdma, uintptr_t SrcAddress, uintptr_t DstAddress, uint32_t DataLength, uint8_t it)
+{
+	if(hdma->State != HAL_DMA_STATE_READY)
+		return HAL_BUSY;
+
+	SimClock_Advance(SimCost.DmaStart);
+
+	hdma->State = HAL_DMA_STATE_BUSY;
+	hdma->SimSrc = SrcAddress;
+	hdma->SimDst = DstAddress;
+	hdma->SimCount = DataLength;
+	hdma->SimIt = it;
+	hdma->SimTc = 0;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef *hdma, uintptr_t SrcAddress, uintptr_t DstAddress, uint32_t DataLength)
+{
+	return SimDma_Start(hdma, SrcAddress, DstAddress, DataLength, 0);
+}
+
+HAL_StatusTypeDef HAL_DMA_Start_IT(DMA_HandleTypeDef *hdma, uintptr_t SrcAddress, uintptr_t DstAddress, uint32_t DataLength)
+{
+	return SimDma_Start(hdma, SrcAddress, DstAddress, DataLength, 1);
+}
+
+HAL_StatusTypeDef HAL_DMA_Abort(DMA_HandleTypeDef *hdma)
+{
+	if(hdma->State != HAL_DMA_STATE_BUSY)
+	{
+		hdma->ErrorCode = HAL_DMA_ERROR_NO_XFER;
+		return HAL_ERROR;
+	}
+
+	hdma->SimCount = 0;
+	hdma->SimTc = 0;
+	hdma->State = HAL_DMA_STATE_READY;
+
+	return HAL_OK;
+}
+
+//
+//	USART
+//
+void SimUsart_Attach(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+	uint32_t pos = 0;
+
+	while(!(GPIO_Pin & (1U << pos)))
+		pos++;
+
+	Usart.Port = GPIOx;
+	Usart.Pin = GPIO_Pin;
+
+	GPIOx->MODER = (GPIOx->MODER & ~(3U << (pos * 2))) | (1U << (pos * 2)); // Alternate function, open-drain
+	GPIOx->OTYPER |= GPIO_Pin;
+	GPIOx->ODR |= GPIO_Pin;
+	SimBus_Update();
+}
+
+static void SimUsart_Drive(uint8_t level)
+{
+	if(level)
+		Usart.Port->ODR |= Usart.Pin;
+	else
+		Usart.Port->ODR &= ~(uint32_t)Usart.Pin;
+
+	SimBus_Update();
+}
+
+//
+//	Transmit data register and TX DMA stream
+//
+static void SimUsart_Load(void)
+{
+	if(Usart.TdrFull || !Usart.TxCount)
+		return;
+
+	Usart.Tdr = *Usart.TxData++;
+	Usart.TdrFull = 1;
+	SimUsart1.Sr[0] &= ~USART_SR_TXE;
+
+	if(!--Usart.TxCount)
+		Usart.TxDone = 1;
+}
+
+static void SimUsart_StartFrame(void)
+{
+	Usart.Shifting = 1;
+	Usart.Frame = ((uint16_t)Usart.Tdr << 1) | 0x200;
+	Usart.Echo = 0;
+	Usart.Step = 0;
+	Usart.Start = SimClock_Now();
+	Usart.Bit = (uint64_t)SimUsart1.BRR * 1000000000ULL / SIM_USART_PCLK;
+
+	Usart.TdrFull = 0;
+	SimUsart1.Sr[0] |= USART_SR_TXE;
+	SimUsart1.Sr[0] &= ~USART_SR_TC;
+
+	SimUsart_Load(); // Next frame goes to TDR while this one shifts out
+}
+
+//
+//	Register changes since the last look
+//
+static void SimUsart_Sync(void)
+{
+	if(SimUsart1.Dr[0] != Usart.Dr) // CPU wrote DR
+	{
+		Usart.Tdr = (uint8_t)SimUsart1.Dr[0];
+		Usart.TdrFull = 1;
+		SimUsart1.Sr[0] &= ~USART_SR_TXE;
+		SimUsart1.Dr[0] = Usart.Dr;
+	}
+
+	SimUsart_Load();
+
+	if(!Usart.Shifting && Usart.TdrFull && (SimUsart1.CR1 & USART_CR1_UE) && Usart.Port)
+		SimUsart_StartFrame();
+}
+
+static void SimUsart_Step(void)
+{
+	uint8_t bit = Usart.Step / 2;
+
+	SimGpio_Sync();
+
+	if(Usart.Step == SIM_USART_STEPS) // End of the stop bit
+	{
+		Usart.Shifting = 0;
+		if(Usart.TdrFull && (SimUsart1.CR1 & USART_CR1_UE))
+			SimUsart_StartFrame();
+		else
+			SimUsart1.Sr[0] |= USART_SR_TC;
+		return;
+	}
+
+	if(!(Usart.Step & 1))
+		SimUsart_Drive((Usart.Frame >> bit) & 1);
+	else if(bit >= 1 && bit <= 8)
+	{
+		SimBus_RefreshInput();
+		if(bit == 1)
+			SimBus_Sampled(Usart.Port, Usart.Pin);
+		if(Usart.Port->Idr[0] & Usart.Pin)
+			Usart.Echo |= 1U << (bit - 1);
+	}
+	else if(bit == 9) // Middle of the stop bit - received byte is in DR
+	{
+		if(SimUsart1.Sr[0] & USART_SR_RXNE)
+			SimUsart1.Sr[0] |= USART_SR_ORE;
+
+		Usart.Dr = 0x100 | Usart.Echo;
+		SimUsart1.Dr[0] = Usart.Dr;
+		SimUsart1.Sr[0] |= USART_SR_RXNE;
+
+		if(Usart.RxCount) // RX DMA reads DR at once
+		{
+			*Usart.RxData++ = Usart.Echo;
+			SimUsart1.Sr[0] &= ~USART_SR_RXNE;
+			if(!--Usart.RxCount)
+				Usart.RxDone = 1;
+		}
+	}
+
+	Usart.Step++;
+}
+
+uint8_t SimUsart_NextIrq(uint64_t until, uint64_t* when)
+{
+	*when = UINT64_MAX;
+
+	SimUsart_Sync();
+
+	if(Usart.Shifting)
+	{
+		*when = Usart.Start + Usart.Step * Usart.Bit / 2;
+		Usart.Event = SIM_USART_EVENT_STEP;
+	}
+
+	if(!Usart.InIrq && !Primask && SimClock_Now() < *when)
+	{
+		if(Usart.RxDone)
+		{
+			*when = SimClock_Now();
+			Usart.Event = SIM_USART_EVENT_RX_IRQ;
+		}
+		else if(Usart.TxDone && !Usart.TdrFull && (SimUsart1.Sr[0] & USART_SR_TC))
+		{
+			*when = SimClock_Now();
+			Usart.Event = SIM_USART_EVENT_TC_IRQ;
+		}
+	}
+
+	return *when <= until;
+}
+
+void SimUsart_Irq(void)
+{
+	uint64_t start = SimClock_Now();
+
+	if(Usart.Event == SIM_USART_EVENT_STEP)
+	{
+		SimUsart_Step();
+		return;
+	}
+
+	Usart.InIrq = 1;
+	SimClock_Advance(SimCost.Irq);
+
+	if(Usart.Event == SIM_USART_EVENT_RX_IRQ) // DMA interrupt - UART_DMAReceiveCplt
+	{
+		Usart.RxDone = 0;
+		Usart.Handle->RxState = HAL_UART_STATE_READY;
+		HAL_UART_RxCpltCallback(Usart.Handle);
+	}
+	else // USART interrupt - UART_EndTransmit_IT
+	{
+		Usart.TxDone = 0;
+		Usart.Handle->gState = HAL_UART_STATE_READY;
+	}
+
+	SimGpio_Sync();
+	Usart.InIrq = 0;
+
+	TimIrqTime += SimClock_Now() - start;
+}
+
+uint32_t SimUsart_Access(void)
+{
+	SimGpio_Sync();
+	SimUsart_Sync();
+
+	SimClock_Advance(SimCost.CyclePoll);
+
+	return 0;
+}
+
+uint32_t SimUsart_DataAccess(void)
+{
+	SimUsart_Access();
+	SimUsart1.Sr[0] &= ~USART_SR_RXNE;
+
+	return 0;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+	return SIM_USART_PCLK;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void)
+{
+	return SIM_USART_PCLK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	if(huart->gState != HAL_UART_STATE_READY)
+		return HAL_BUSY;
+
+	SimClock_Advance(SimCost.DmaStart);
+
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	Usart.Handle = huart;
+	Usart.TxData = pData;
+	Usart.TxCount = Size;
+	Usart.TxDone = 0;
+	SimUsart1.Sr[0] &= ~USART_SR_TC;
+	SimUsart_Sync();
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Receive_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	if(huart->RxState != HAL_UART_STATE_READY)
+		return HAL_BUSY;
+
+	SimClock_Advance(SimCost.DmaStart);
+
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	Usart.Handle = huart;
+	Usart.RxData = pData;
+	Usart.RxCount = Size;
+	Usart.RxDone = 0;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef *huart)
+{
+	Usart.RxCount = 0;
+	Usart.RxDone = 0;
+	huart->RxState = HAL_UART_STATE_READY;
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Abort(UART_HandleTypeDef *huart)
+{
+	Usart.TxCount = 0;
+	Usart.TxDone = 0;
+	huart->gState = HAL_UART_STATE_READY;
+
+	return HAL_UART_AbortReceive(huart);
+}
+
+__attribute__((weak)) void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	(void)huart;
+}
+
+//
+//	FLASH
+//
+//	Mapped at the real address before main, erased state like a new chip
+//
+__attribute__((constructor)) static void SimFlash_Map(void)
+{
+	void* flash = mmap((void*)(uintptr_t)FLASH_BASE, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+	if(flash != (void*)(uintptr_t)FLASH_BASE)
+	{
+		fprintf(stderr, "sim: cannot map flash at 0x%08X\n", FLASH_BASE);
+		exit(1);
+	}
+
+	memset(flash, 0xFF, SIM_FLASH_SIZE);
+}
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	FlashLocked = 0;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	FlashLocked = 1;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError)
+{
+	uint32_t sector, size;
+
+	*SectorError = 0xFFFFFFFFU;
+
+	if(FlashLocked || pEraseInit->TypeErase != FLASH_TYPEERASE_SECTORS ||
+			pEraseInit->Sector + pEraseInit->NbSectors > FLASH_SECTOR_7 + 1)
+		return HAL_ERROR;
+
+	for(sector = pEraseInit->Sector; sector < pEraseInit->Sector + pEraseInit->NbSectors; sector++)
+	{
+		size = SimFlashSector[sector + 1] - SimFlashSector[sector];
+		memset((void*)(uintptr_t)(FLASH_BASE + SimFlashSector[sector]), 0xFF, size);
+		SimClock_Advance((uint64_t)SimCost.FlashErase * size / 0x20000); // CPU stalls on flash fetch
+	}
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+	if(FlashLocked || TypeProgram != FLASH_TYPEPROGRAM_WORD || (Address & 3) ||
+			Address < FLASH_BASE || Address >= FLASH_BASE + SIM_FLASH_SIZE)
+		return HAL_ERROR;
+
+	*(uint32_t*)(uintptr_t)Address &= (uint32_t)Data; // Programming clears bits only
+	SimClock_Advance(SimCost.FlashProgram);
+
+	return HAL_OK;
+}
+
+//
+//	Tick
+//
+void HAL_Delay(uint32_t Delay)
+{
+	SimGpio_Sync();
+	SimClock_Advance((uint64_t)(Delay + 1) * SIM_NS_PER_MS); // HAL waits one extra tick
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return (uint32_t)(SimClock_Now() / SIM_NS_PER_MS);
+}
+
+void _Error_Handler(char * file, int line)
+{
+	(void)file;
+	(void)line;
+}
@@ -0,0 +1,516 @@
+/*
+ * sim_main.c
+ *
+ *	The MIT License.
+ *
+ *	Host benchmark - runs the unchanged driver against the simulated bus
+ *	and reports the virtual bus time every call used.
+ *
+ *	Usage: ds18b20_sim [sensors] [resolution] [gpio|ideal|uart|multi] [others] [parasite]
+ *
+ *	uart - bus on the TX pin of a half-duplex USART1, frames and DMA modelled
+ *	multi - every sensor on its own bus (pins of GPIOB), read one bus
+ *	after another and then all in lock-step
+ *	others - devices of other families (DS2413, iButton) on the same bus
+ *	parasite - that many of the sensors take power from the bus line only
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "sim_bus.h"
+#include "ds18b20.h"
+#include "sim_onewire.h"
+#include "onewire_async.h"
+#include "onewire_uart.h"
+
+DS18B20_BUS_DEFINE(Bus, SIM_BUS_MAX_DEVICES);
+
+static OneWireUart_t Uart;
+static UART_HandleTypeDef Huart1 = // MX_USART1_UART_Init in half-duplex
+{
+	.Instance = USART1,
+	.gState = HAL_UART_STATE_READY,
+	.RxState = HAL_UART_STATE_READY,
+};
+
+static uint64_t CallStart;
+static SimBusStats_t CallStats;
+
+static void Sim_TimerIrq(void) // TIM1_CC_IRQHandler
+{
+	OneWireAsync_IRQHandler(&htim1);
+}
+
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+	OneWireUart_RxCpltCallback(&Uart, huart);
+}
+
+static void Bench_Begin(void)
+{
+	SimBus_ResetStats();
+	CallStart = SimClock_Now();
+}
+
+static void Bench_End(const char* name)
+{
+	uint64_t time = SimClock_Now() - CallStart;
+
+	SimBus_GetStats(&CallStats);
+	printf("%-20s %10llu us  resets %4u  slots %5u  write violations %4u  late samples %4u  brownouts %3u  eeprom %3u\n",
+			name, (unsigned long long)(time / SIM_NS_PER_US),
+			CallStats.Resets, CallStats.Slots, CallStats.WriteViolations, CallStats.LateSamples, CallStats.Brownouts, CallStats.EepromWrites);
+}
+
+//
+//	Boot - first one searches the bus, later ones find the table in flash
+//
+static void Bench_Init(const char* backend, int resolution, const char* name)
+{
+	while(OneWire_PullupActive(&Bus.OneWire)) // Restart after the parasite conversion - a reset would cut its supply
+		SimClock_Advance(SIM_NS_PER_MS);
+
+	memset(&Bus.OneWire, 0, sizeof(Bus.OneWire)); // Restart - flash keeps its content
+
+	Bench_Begin();
+	if(!strcmp(backend, "ideal"))
+	{
+		SimOneWire_Init(&Bus.OneWire, DS18B20_GPIO_Port, DS18B20_Pin);
+		DS18B20_InitBus(&Bus, (DS18B20_Resolution_t)resolution);
+	}
+	else if(!strcmp(backend, "uart"))
+	{
+		SimUsart_Attach(DS18B20_GPIO_Port, DS18B20_Pin);
+		USART1->CR1 |= USART_CR1_UE;
+		OneWire_InitUart(&Bus.OneWire, &Uart, &Huart1);
+		DS18B20_InitBus(&Bus, (DS18B20_Resolution_t)resolution);
+	}
+	else
+	{
+		DS18B20_Init(&Bus, DS18B20_GPIO_Port, DS18B20_Pin, (DS18B20_Resolution_t)resolution);
+	}
+	Bench_End(name);
+}
+
+//
+//	Mixed bus - whole ROM tree against the DS18B20 branch only
+//
+static void Bench_Search(void)
+{
+	uint8_t next, found = 0;
+
+	Bench_Begin();
+	for(next = OneWire_First(&Bus.OneWire); next; next = OneWire_Next(&Bus.OneWire))
+		found++;
+	Bench_End("OneWire_First/Next");
+	printf("%-20s %10u devices\n", "", found);
+
+	found = 0;
+	Bench_Begin();
+	OneWire_TargetSetup(&Bus.OneWire, DS18B20_FAMILY_CODE);
+	for(next = OneWire_Search(&Bus.OneWire, ONEWIRE_CMD_SEARCHROM); next && DS18B20_Is(Bus.OneWire.ROM_NO);
+			next = (Bus.OneWire.LastDiscrepancy > 8) ? OneWire_Next(&Bus.OneWire) : 0) // Like DS18B20_InitBus
+		found++;
+	Bench_End("OneWire_TargetSetup");
+	printf("%-20s %10u DS18B20\n", "", found);
+}
+
+//
+//	Transient on all sensors - 2 s steady, 3 s at 4 degC/s, 7 s steady.
+//	Results per second of every phase and the longest time between two
+//	results during the ramp.
+//
+static void Bench_Transient(const char* name, uint8_t fastest)
+{
+	uint64_t start, now;
+	uint32_t results[3] = { 0 }, last = 0, gap = 0;
+	int16_t physical = 0, ramp;
+	int i, phase;
+
+	DS18B20_SetAdaptive(&Bus, fastest);
+	start = SimClock_Now();
+
+	Bench_Begin();
+	while((now = (SimClock_Now() - start) / SIM_NS_PER_MS) < 12000)
+	{
+		phase = (now < 2000) ? 0 : (now < 5000) ? 1 : 2;
+		ramp = (int16_t)(16 * 20 + (phase ? ((phase == 1) ? now - 2000 : 3000) * 64 / 1000 : 0));
+		if(ramp != physical)
+		{
+			physical = ramp;
+			for(i = 0; i < SimBus_DeviceCount(); i++)
+				SimBus_SetTemperature(i, physical);
+		}
+
+		if(DS18B20_Poll(&Bus))
+		{
+			results[phase]++;
+			if(phase == 1 && last && now - last > gap)
+				gap = (uint32_t)(now - last);
+			last = (uint32_t)now;
+		}
+		SimClock_Advance(10 * SIM_NS_PER_US); // Rest of the main loop
+	}
+	Bench_End(name);
+
+	printf("%-20s %10.1f results/s steady, %.1f ramp, %.1f settled, %u ms longest gap on the ramp, %u bit at the end\n", "",
+			results[0] / 2.0, results[1] / 3.0, results[2] / 7.0, gap,
+			((Bus.Status[0] & DS18B20_STATUS_RESOLUTION) >> DS18B20_RESOLUTION_R0) + 9);
+
+	DS18B20_SetAdaptive(&Bus, 0);
+}
+
+//
+//	Age of the readings - sampled every ms over all sensors for 10 s, from
+//	the end of the conversion that gave the value in the table. The first
+//	3 s let the scheduler spread the conversions out.
+//
+static void Bench_Age(const char* name, uint8_t (*poll)(Ds18b20Bus_t* bus))
+{
+	uint64_t settled, end, sum = 0, count = 0, next;
+	uint32_t readings = 0, age, oldest = 0, now;
+	uint32_t last[SIM_BUS_MAX_DEVICES];
+	int i;
+
+	while(DS18B20_AsyncBusy(&Bus) || OneWire_PullupActive(&Bus.OneWire)) // Previous scheduler done
+		SimClock_Advance(10 * SIM_NS_PER_US);
+	Bus.PollState = DS18B20_POLL_IDLE;
+
+	settled = SimClock_Now() + 3000 * SIM_NS_PER_MS;
+	end = settled + 10000 * SIM_NS_PER_MS;
+	next = settled;
+
+	Bench_Begin();
+	while(SimClock_Now() < end)
+	{
+		poll(&Bus);
+		SimClock_Advance(10 * SIM_NS_PER_US); // Rest of the main loop
+
+		if(SimClock_Now() < settled)
+			memcpy(last, Bus.SampleTick, sizeof(last[0]) * DS18B20_Quantity(&Bus));
+		if(SimClock_Now() < next)
+			continue;
+		next += SIM_NS_PER_MS;
+
+		now = HAL_GetTick();
+		for(i = 0; i < DS18B20_Quantity(&Bus); i++)
+		{
+			if(Bus.SampleTick[i] != last[i]) // New reading of this sensor
+			{
+				last[i] = Bus.SampleTick[i];
+				readings++;
+			}
+
+			age = now - Bus.SampleTick[i] - DS18B20_ConversionTime((DS18B20_Resolution_t)(((Bus.Status[i] & DS18B20_STATUS_RESOLUTION) >> DS18B20_RESOLUTION_R0) + 9));
+			sum += age;
+			count++;
+			if(age > oldest)
+				oldest = age;
+		}
+	}
+	Bench_End(name);
+
+	printf("%-20s %10.1f readings/s, age of the readings %llu ms mean, %u ms oldest\n", "",
+			readings / 10.0, (unsigned long long)(count ? sum / count : 0), oldest);
+}
+
+//
+//	Parallel buses, one sensor each
+//
+static int Bench_Multi(int sensors)
+{
+	OneWireMulti_t multi;
+	int16_t temperature[ONEWIRE_MULTI_MAX_BUSES];
+	uint16_t pins = (uint16_t)((1U << sensors) - 1);
+	uint16_t valid = 0;
+	int i;
+
+	SimBus_Attach(GPIOB, pins);
+
+	for(i = 0; i < sensors; i++)
+	{
+		int dev = SimBus_AddDs18b20(0x1A2B3C00ULL + (uint64_t)i * 0x01020305ULL);
+		SimBus_SetTemperature(dev, (int16_t)(16 * 21 + i * 7));
+		SimBus_SetLine(dev, (uint8_t)i);
+	}
+
+	OneWireMulti_Init(&multi, GPIOB, pins);
+
+	Bench_Begin();
+	DS18B20_MultiStartAll(&multi);
+	Bench_End("DS18B20_MultiStartAll");
+
+	HAL_Delay(750); // Power-up resolution is 12 bit
+
+	Bench_Begin();
+	for(i = 0; i < sensors; i++) // One bus after another
+		valid |= DS18B20_MultiRead(&multi, 1U << i, NULL, temperature);
+	Bench_End("read bus by bus");
+
+	Bench_Begin();
+	valid = DS18B20_MultiRead(&multi, pins, NULL, temperature);
+	Bench_End("DS18B20_MultiRead");
+
+	printf("\nbuses read: %d of %d\n", __builtin_popcount(valid), sensors);
+	for(i = 0; i < sensors; i++)
+	{
+		if(valid & (1U << i))
+			printf("bus %d. Temp: %ld mC\n", i, (long)DS18B20_ToMilliCelsius(temperature[i]));
+		else
+			printf("bus %d. Temp: invalid\n", i);
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	int sensors = 4;
+	int resolution = DS18B20_Resolution_12bits;
+	const char* backend = "gpio";
+	int others = 0;
+	int parasite = 0;
+	int i;
+	int32_t temperature;
+	uint8_t ROM[8];
+
+	if(argc > 1)
+		sensors = atoi(argv[1]);
+	if(argc > 2)
+		resolution = atoi(argv[2]);
+	if(argc > 3)
+		backend = argv[3];
+	if(argc > 4)
+		others = atoi(argv[4]);
+	if(argc > 5)
+		parasite = atoi(argv[5]);
+
+	if(sensors < 0 || others < 0 || parasite < 0 || parasite > sensors || sensors + others > SIM_BUS_MAX_DEVICES || resolution < 9 || resolution > 12 ||
+			(strcmp(backend, "gpio") && strcmp(backend, "ideal") && strcmp(backend, "uart") && strcmp(backend, "multi")) ||
+			(!strcmp(backend, "multi") && sensors > ONEWIRE_MULTI_MAX_BUSES))
+	{
+		fprintf(stderr, "usage: %s [sensors 0-%d] [resolution 9-12] [gpio|ideal|uart|multi] [others] [parasite]\n", argv[0], SIM_BUS_MAX_DEVICES);
+		return 1;
+	}
+
+	if(!strcmp(backend, "multi"))
+		return Bench_Multi(sensors);
+
+	SimBus_Attach(DS18B20_GPIO_Port, DS18B20_Pin);
+
+	for(i = 0; i < sensors; i++)
+	{
+		int dev = SimBus_AddDs18b20(0x1A2B3C00ULL + (uint64_t)i * 0x01020305ULL);
+		SimBus_SetTemperature(dev, (int16_t)(16 * 21 + i * 7)); // 21 degC and up
+		if(i && i == sensors - 1)
+			SimBus_SetTemperature(dev, (int16_t)(-16 * 10 - 7)); // Last one below zero
+		SimBus_SetParasite(dev, i < parasite);
+	}
+
+	for(i = 0; i < others; i++)
+	{
+		ROM[0] = (i & 1) ? 0x01 : 0x3A; // DS1990A iButton, DS2413 switch
+		ROM[1] = (uint8_t)(0x40 + i * 13);
+		ROM[2] = (uint8_t)(0x11 * i);
+		ROM[3] = ROM[4] = ROM[5] = ROM[6] = 0;
+		ROM[7] = OneWire_CRC8(ROM, 7);
+		SimBus_AddDevice(ROM);
+	}
+
+	Bench_Init(backend, resolution, "DS18B20_Init");
+	Bench_Init(backend, resolution, "DS18B20_Init stored"); // Restart, same sensors
+
+	if(others)
+		Bench_Search();
+
+	HAL_Delay(750); // Conversion started by Init
+
+	Bench_Begin();
+	DS18B20_StartAll(&Bus);
+	Bench_End("DS18B20_StartAll");
+
+	HAL_Delay(DS18B20_TimeToReadyAll(&Bus));
+
+	Bench_Begin();
+	DS18B20_ReadAll(&Bus);
+	Bench_End("DS18B20_ReadAll");
+
+	{ // Health check - presence of every sensor without reading it
+		uint8_t present = 0;
+
+		Bench_Begin();
+		for(i = 0; i < DS18B20_Quantity(&Bus); i++)
+			present += DS18B20_IsPresent(&Bus, i);
+		Bench_End("DS18B20_IsPresent all");
+		printf("%-20s %10u sensors present\n", "", present);
+	}
+
+	{ // Alarm search instead of reading every scratchpad
+		uint8_t alarms[8], count;
+
+		DS18B20_SetAlarmAll(&Bus, 40, 0); // Sensors from 40 degC up and the one below zero
+		HAL_Delay(10); // EEPROM copy
+		DS18B20_StartAll(&Bus);
+		HAL_Delay(DS18B20_TimeToReadyAll(&Bus));
+
+		Bench_Begin();
+		count = DS18B20_AlarmScan(&Bus, alarms, sizeof(alarms));
+		Bench_End("DS18B20_AlarmScan");
+
+		printf("%-20s %10u sensors in alarm:", "", count);
+		for(i = 0; i < count && i < (int)sizeof(alarms); i++)
+			printf(" %u", alarms[i]);
+		printf("\n");
+	}
+
+	{ // Change-driven reads - first cycle reads all, then only sensors that moved
+		static const char* const name[3] = { "ReadChanged first", "ReadChanged steady", "ReadChanged 1 moved" };
+		uint8_t count;
+		int cycle;
+
+		for(cycle = 0; cycle < 3; cycle++)
+		{
+			if(cycle == 2 && sensors)
+				SimBus_SetTemperature(0, (int16_t)(16 * 24)); // +3 degC on the first device
+
+			DS18B20_StartAll(&Bus);
+			HAL_Delay(DS18B20_TimeToReadyAll(&Bus));
+
+			Bench_Begin();
+			count = DS18B20_ReadChanged(&Bus);
+			Bench_End(name[cycle]);
+			printf("%-20s %10u sensors read\n", "", count);
+		}
+
+		if(sensors)
+			SimBus_SetTemperature(0, (int16_t)(16 * 21));
+	}
+
+	if(!strcmp(backend, "gpio")) // Async engine drives the GPIO pin itself
+	{
+		uint64_t irq;
+		uint32_t loops = 0;
+
+		for(i = 0; i < DS18B20_Quantity(&Bus); i++)
+			Bus.Status[i] &= ~DS18B20_STATUS_VALID;
+
+		SimTim_SetIrqHandler(Sim_TimerIrq);
+		irq = SimTim_IrqTime();
+
+		Bench_Begin();
+		DS18B20_ReadAllAsync(&Bus);
+		while(DS18B20_AsyncBusy(&Bus)) // Main loop keeps running, 10 us per pass
+		{
+			SimClock_Advance(10 * SIM_NS_PER_US);
+			loops++;
+		}
+		Bench_End("DS18B20_ReadAllAsync");
+
+		irq = SimTim_IrqTime() - irq;
+		printf("%-20s %10llu us in interrupts (%.1f%% CPU), %u main loop passes\n", "",
+				(unsigned long long)(irq / SIM_NS_PER_US),
+				100.0 * irq / (SimClock_Now() - CallStart), loops);
+	}
+
+	if(!strcmp(backend, "gpio")) // Scheduler - as many results as the resolution allows
+	{
+		uint64_t end = SimClock_Now() + 10000 * SIM_NS_PER_MS;
+		uint32_t results = 0, polls = 0;
+
+		Bench_Begin();
+		while(SimClock_Now() < end)
+		{
+			results += DS18B20_Poll(&Bus);
+			polls++;
+			SimClock_Advance(10 * SIM_NS_PER_US); // Rest of the main loop
+		}
+		Bench_End("DS18B20_Poll 10 s");
+
+		printf("%-20s %10.1f results/s (tCONV %u ms), %u main loop passes\n", "",
+				results / 10.0, DS18B20_ConversionTime((DS18B20_Resolution_t)resolution), polls);
+	}
+
+	if(!strcmp(backend, "gpio") || !strcmp(backend, "ideal")) // All sensors at once against one after another
+	{
+		Bench_Age("DS18B20_Poll age", DS18B20_Poll);
+		Bench_Age("PollStaggered age", DS18B20_PollStaggered);
+	}
+
+	if(!strcmp(backend, "gpio") && resolution > DS18B20_Resolution_9bits) // Fixed resolution against the adaptive mode
+	{
+		Bench_Transient("DS18B20_Poll transient", 0);
+		Bench_Transient("DS18B20_Poll adaptive", DS18B20_Resolution_9bits);
+	}
+
+	printf("\nsensors found: %u of %d\n", DS18B20_Quantity(&Bus), sensors);
+
+	for(i = 0; i < DS18B20_Quantity(&Bus); i++)
+	{
+		DS18B20_GetROM(&Bus, i, ROM);
+		printf("%d. ROM: %02X%02X%02X%02X%02X%02X%02X%02X ", i,
+				ROM[0], ROM[1], ROM[2], ROM[3], ROM[4], ROM[5], ROM[6], ROM[7]);
+
+		if(DS18B20_Find(&Bus, ROM) != i)
+			printf("(lookup failed) ");
+
+		if(DS18B20_GetTemperatureMilli(&Bus, i, &temperature))
+			printf("Temp: %s%ld.%03ld\n", (temperature < 0) ? "-" : "",
+					(long)(labs(temperature) / 1000), (long)(labs(temperature) % 1000));
+		else
+			printf("Temp: invalid\n");
+	}
+
+	if(sensors > 1) // Restart with one sensor unplugged - stored table is rejected
+	{
+		while(DS18B20_AsyncBusy(&Bus)) // Let reads queued by the last Poll finish
+			SimClock_Advance(10 * SIM_NS_PER_US);
+
+		SimBus_SetConnected(sensors - 1, 0);
+
+		Bench_Begin();
+		SimBus_GetROM(sensors - 1, ROM);
+		i = DS18B20_IsPresent(&Bus, DS18B20_Find(&Bus, ROM));
+		Bench_End("DS18B20_IsPresent gone");
+		printf("%-20s %10s\n", "", i ? "present" : "missing");
+
+		Bench_Init(backend, resolution, "DS18B20_Init changed");
+		Bench_Init(backend, resolution, "DS18B20_Init stored");
+		printf("sensors found after unplug: %u\n", DS18B20_Quantity(&Bus));
+	}
+
+	if(sensors > 1 && sensors + others < SIM_BUS_MAX_DEVICES) // Hot-plug - one sensor back, one new, one gone
+	{
+		uint64_t step, longest = 0, end = SimClock_Now() + 10000 * SIM_NS_PER_MS;
+		uint32_t steps = 0, added = 0, removed = 0;
+		uint8_t event;
+
+		SimBus_SetConnected(sensors - 1, 1);
+		SimBus_SetTemperature(SimBus_AddDs18b20(0x0F1E2D3CULL), (int16_t)(16 * 30));
+		SimBus_SetConnected(0, 0);
+
+		Bench_Begin();
+		while((added < 2 || removed < 1) && SimClock_Now() < end) // Main loop calls it, 10 us per pass
+		{
+			step = SimClock_Now();
+			event = DS18B20_Hotplug(&Bus);
+			step = SimClock_Now() - step;
+			if(step > longest)
+				longest = step;
+			if(step) // Bus was free - one search pass
+				steps++;
+
+			added += (event == DS18B20_HOTPLUG_ADDED);
+			removed += (event == DS18B20_HOTPLUG_REMOVED);
+			SimClock_Advance(10 * SIM_NS_PER_US);
+		}
+		Bench_End("DS18B20_Hotplug");
+		printf("%-20s %10u steps, longest %llu us, %u added, %u removed, %u sensors\n", "", steps,
+				(unsigned long long)(longest / SIM_NS_PER_US), added, removed, DS18B20_Quantity(&Bus));
+
+		Bench_Init(backend, resolution, "DS18B20_Init full"); // Same change found by a new search
+	}
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * sim_onewire.c
+ *
+ *	The MIT License.
+ *
+ */
+#include "sim_onewire.h"
+#include "sim_bus.h"
+
+//
+//	Maxim AN126 standard speed timings [us]
+//
+#define SIM_OW_A	6
+#define SIM_OW_B	64
+#define SIM_OW_C	60
+#define SIM_OW_D	10
+#define SIM_OW_E	9
+#define SIM_OW_F	55
+#define SIM_OW_H	480
+#define SIM_OW_I	70
+#define SIM_OW_J	410
+
+static void SimOneWire_Wait(uint32_t us)
+{
+	SimClock_Advance(us * SIM_NS_PER_US);
+}
+
+static void SimOneWire_Drive(OneWire_t* onewire, uint8_t low)
+{
+	if (low)
+		onewire->GPIOx->ODR &= ~(uint32_t)onewire->GPIO_Pin;
+	else
+		onewire->GPIOx->ODR |= onewire->GPIO_Pin;
+
+	SimBus_Update();
+}
+
+static uint8_t SimOneWire_Sample(OneWire_t* onewire)
+{
+	SimBus_RefreshInput();
+	SimBus_Sampled(onewire->GPIOx, onewire->GPIO_Pin);
+
+	return (onewire->GPIOx->Idr[0] & onewire->GPIO_Pin) ? 1 : 0;
+}
+
+static uint8_t SimOneWire_Reset(OneWire_t* onewire)
+{
+	uint8_t i;
+
+	SimOneWire_Drive(onewire, 1);
+	SimOneWire_Wait(SIM_OW_H);
+	SimOneWire_Drive(onewire, 0);
+	SimOneWire_Wait(SIM_OW_I);
+	i = SimOneWire_Sample(onewire);
+	SimOneWire_Wait(SIM_OW_J);
+
+	return i;
+}
+
+static void SimOneWire_WriteBit(OneWire_t* onewire, uint8_t bit)
+{
+	SimOneWire_Drive(onewire, 1);
+	SimOneWire_Wait(bit ? SIM_OW_A : SIM_OW_C);
+	SimOneWire_Drive(onewire, 0);
+	SimOneWire_Wait(bit ? SIM_OW_B : SIM_OW_D);
+}
+
+static uint8_t SimOneWire_ReadBit(OneWire_t* onewire)
+{
+	uint8_t bit;
+
+	SimOneWire_Drive(onewire, 1);
+	SimOneWire_Wait(SIM_OW_A);
+	SimOneWire_Drive(onewire, 0);
+	SimOneWire_Wait(SIM_OW_E);
+	bit = SimOneWire_Sample(onewire);
+	SimOneWire_Wait(SIM_OW_F);
+
+	return bit;
+}
+
+static void SimOneWire_WriteBlock(OneWire_t* onewire, const uint8_t* data, uint16_t len)
+{
+	uint8_t i;
+
+	while (len--)
+	{
+		for (i = 0; i < 8; i++)
+			SimOneWire_WriteBit(onewire, (*data >> i) & 1);
+		data++;
+	}
+}
+
+static void SimOneWire_ReadBlock(OneWire_t* onewire, uint8_t* data, uint16_t len)
+{
+	uint8_t i;
+
+	while (len--)
+	{
+		*data = 0;
+		for (i = 0; i < 8; i++)
+			*data |= SimOneWire_ReadBit(onewire) << i;
+		data++;
+	}
+}
+
+static void SimOneWire_StrongPullup(OneWire_t* onewire, uint8_t on)
+{
+	if (on)
+		onewire->GPIOx->OTYPER &= ~onewire->GPIO_Pin; // Push-pull high
+	else
+		onewire->GPIOx->OTYPER |= onewire->GPIO_Pin;
+
+	SimBus_Update();
+}
+
+const OneWire_Ops_t SimOneWire_Ops = {
+	.Reset = SimOneWire_Reset,
+	.WriteBit = SimOneWire_WriteBit,
+	.ReadBit = SimOneWire_ReadBit,
+	.WriteBlock = SimOneWire_WriteBlock,
+	.ReadBlock = SimOneWire_ReadBlock,
+	.Triplet = NULL,
+	.StrongPullup = SimOneWire_StrongPullup,
+};
+
+void SimOneWire_Init(OneWire_t* onewire, GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+	uint32_t pos = 0;
+
+	OneWire_InitWithOps(onewire, &SimOneWire_Ops, NULL);
+	onewire->GPIOx = GPIOx;
+	onewire->GPIO_Pin = GPIO_Pin;
+
+	while (!(GPIO_Pin & (1U << pos)))
+		pos++;
+
+	GPIOx->ODR |= GPIO_Pin; // Released open-drain output
+	GPIOx->MODER = (GPIOx->MODER & ~(3U << (pos * 2))) | (1U << (pos * 2));
+	GPIOx->OTYPER |= GPIO_Pin;
+	SimBus_Update();
+}
@@ -8,287 +8,1844 @@
  *      mateusz@msalamon.pl
  *
  */
+#include <string.h>
 #include "ds18b20.h"
+#include "onewire_async.h"
+#include "ds18b20_store.h"
 
 //
 //	VARIABLES
 //
-Ds18b20Sensor_t	ds18b20[_DS18B20_MAX_SENSORS];
+static const uint8_t StartCommand[2] = { ONEWIRE_CMD_SKIPROM, DS18B20_CMD_CONVERTTEMP };
 
-OneWire_t OneWire;
-uint8_t	OneWireDevices;
-uint8_t TempSensorCount=0;
+static const uint16_t ConversionTime[4] = { 94, 188, 375, 750 }; // tCONV max [ms] for 9..12 bits
 
 //
 //	FUNCTIONS
 //
 
+//
+//	Conversion time bookkeeping
+//
+uint16_t DS18B20_ConversionTime(DS18B20_Resolution_t resolution)
+{
+	if (resolution < DS18B20_Resolution_9bits || resolution > DS18B20_Resolution_12bits)
+		return ConversionTime[3]; // Unknown - take the longest
+
+	return ConversionTime[resolution - DS18B20_Resolution_9bits];
+}
+
+static void DS18B20_ConversionStarted(Ds18b20Bus_t* bus, uint8_t number, uint32_t tick)
+{
+	bus->ConversionStart[number] = tick;
+	bus->Status[number] |= DS18B20_STATUS_CONVERTING;
+}
+
+//
+//	Resolution kept in the status bits, same coding as the configuration register
+//
+static uint8_t DS18B20_KnownResolution(Ds18b20Bus_t* bus, uint8_t number)
+{
+	return ((bus->Status[number] & DS18B20_STATUS_RESOLUTION) >> DS18B20_RESOLUTION_R0) + 9;
+}
+
+static void DS18B20_SetKnownResolution(Ds18b20Bus_t* bus, uint8_t number, uint8_t resolution)
+{
+	bus->Status[number] &= ~DS18B20_STATUS_RESOLUTION;
+	bus->Status[number] |= ((resolution - 9) << DS18B20_RESOLUTION_R0) & DS18B20_STATUS_RESOLUTION;
+}
+
+//
+//	Configuration register value for @resolution, reserved bits set
+//
+static uint8_t DS18B20_ConfigRegister(uint8_t resolution)
+{
+	return 0x1F | (((resolution - 9) << DS18B20_RESOLUTION_R0) & DS18B20_STATUS_RESOLUTION);
+}
+
+static uint8_t DS18B20_ConfigResolution(uint8_t conf)
+{
+	return ((conf & DS18B20_STATUS_RESOLUTION) >> DS18B20_RESOLUTION_R0) + 9;
+}
+
+//
+//	Cached EEPROM settings - the scratchpad holds the same unless
+//	DS18B20_STATUS_BAND is set or the known resolution differs
+//
+static void DS18B20_SetConfig(Ds18b20Bus_t* bus, uint8_t number, uint8_t th, uint8_t tl, uint8_t conf)
+{
+	bus->Config[number][0] = th;
+	bus->Config[number][1] = tl;
+	bus->Config[number][2] = conf;
+	bus->Status[number] |= DS18B20_STATUS_CONFIG;
+}
+
+//
+//	Skip ROM and @command - every sensor of the bus at once
+//
+static void DS18B20_SkipRom(Ds18b20Bus_t* bus, uint8_t command)
+{
+	uint8_t frame[2] = { ONEWIRE_CMD_SKIPROM, command };
+
+	OneWire_WriteBlock(&bus->OneWire, frame, sizeof(frame));
+}
+
+//
+//	Function @command of @number - its Match ROM frame and the command go
+//	out as one block straight from the sensor table. The only device of
+//	a bus is addressed by Skip ROM, 64 bit slots shorter.
+//
+static void DS18B20_Select(Ds18b20Bus_t* bus, uint8_t number, uint8_t command)
+{
+	if (bus->SingleDevice)
+	{
+		DS18B20_SkipRom(bus, command);
+		return;
+	}
+
+	bus->Select[number][ONEWIRE_SELECT_LEN] = command;
+	OneWire_WriteBlock(&bus->OneWire, bus->Select[number], DS18B20_SELECT_LEN);
+}
+
+//
+//	Single device bus - the verify pass along the ROM of the only sensor
+//	shows no branch, so nothing else answers Skip ROM. Any other device,
+//	of any family, branches off somewhere on the 64 bits.
+//
+static uint8_t DS18B20_Branched(Ds18b20Bus_t* bus)
+{
+	uint8_t i;
+
+	for (i = 0; i < 8; i++)
+	{
+		if (bus->OneWire.Discrepancy[i])
+			return 1;
+	}
+
+	return 0;
+}
+
+//
+//	The search or the stored check has set bus->SensorsOnly - with one
+//	sensor in the table it is the only device
+//
+static void DS18B20_CheckSingle(Ds18b20Bus_t* bus)
+{
+	bus->SingleDevice = bus->SensorCount == 1 && bus->SensorsOnly;
+}
+
+//
+//	Skip ROM writes and copies reach every device on the bus, so they
+//	are only for a bus with nothing but table sensors on it. The search,
+//	the stored check or the last hot-plug round proved it; a verify pass
+//	now shows any device of another family, they all branch off in the
+//	family code.
+//
+static uint8_t DS18B20_SkipRomWritable(Ds18b20Bus_t* bus)
+{
+	if (!bus->SensorsOnly)
+		return 0;
+
+	if (!OneWire_Verify(&bus->OneWire, bus->Address[0]) || DS18B20_UnknownBranch(bus, 0, 0))
+	{
+		bus->SensorsOnly = 0; // Until the next hot-plug round or search proves it again
+		bus->SingleDevice = 0; // Match ROM for the writes that follow
+		return 0;
+	}
+
+	return 1;
+}
+
+//
+//	Write Scratchpad data - TH, TL and the configuration register
+//
+static void DS18B20_WriteScratchpad(Ds18b20Bus_t* bus, uint8_t th, uint8_t tl, uint8_t conf)
+{
+	uint8_t data[3] = { th, tl, conf };
+
+	OneWire_WriteBlock(&bus->OneWire, data, sizeof(data));
+}
+
+//
+//	Scratchpad of @number into the cache - has to hold the EEPROM content,
+//	right after power-up or Recall E2
+//
+static uint8_t DS18B20_ReadConfig(Ds18b20Bus_t* bus, uint8_t number)
+{
+	uint8_t data[DS18B20_DATA_LEN];
+
+	bus->Status[number] &= ~DS18B20_STATUS_CONFIG;
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, ONEWIRE_CMD_RSCRATCHPAD); // Read scratchpad command
+	OneWire_ReadBlock(&bus->OneWire, data, DS18B20_DATA_LEN);
+
+#ifdef _DS18B20_USE_CRC
+	if (OneWire_CRC8(data, 8) != data[8])
+		return 0;
+#endif
+
+	if ((data[4] & 0x9F) != 0x1F) // Reserved bits - no answer
+		return 0;
+
+	DS18B20_SetConfig(bus, number, data[2], data[3], data[4]);
+	DS18B20_SetKnownResolution(bus, number, DS18B20_ConfigResolution(data[4]));
+
+	return 1;
+}
+
+//
+//	Cache filled on first use - Recall E2 first, the scratchpad may hold a band
+//
+static uint8_t DS18B20_CacheConfig(Ds18b20Bus_t* bus, uint8_t number)
+{
+	if (bus->Status[number] & DS18B20_STATUS_CONFIG)
+		return 1;
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, ONEWIRE_CMD_RECEEPROM); // EEPROM back to the scratchpad
+
+	return DS18B20_ReadConfig(bus, number);
+}
+
+//
+//	Parasite sensors take the conversion and EEPROM current from the
+//	strong pull-up. A transport without one cannot run them.
+//
+static uint8_t DS18B20_Powered(Ds18b20Bus_t* bus, uint8_t number)
+{
+	return !(bus->Status[number] & DS18B20_STATUS_PARASITE) || OneWire_HasStrongPullup(&bus->OneWire);
+}
+
+//
+//	Skip ROM conversion or copy - every parasite sensor of the bus on the
+//	strong pull-up at once
+//
+static uint8_t DS18B20_PoweredAll(Ds18b20Bus_t* bus)
+{
+	return !bus->ParasiteCount || (bus->ParasiteCount <= _DS18B20_PARASITE_MAX && OneWire_HasStrongPullup(&bus->OneWire));
+}
+
+//
+//	End of an EEPROM copy - read slots answer 0 while an external powered
+//	sensor copies, the strong pull-up runs out before the first slot
+//
+static void DS18B20_CopyWait(Ds18b20Bus_t* bus)
+{
+	uint32_t start = HAL_GetTick();
+
+	while (!OneWire_ReadBit(&bus->OneWire) && (HAL_GetTick() - start) <= DS18B20_COPY_TIME)
+		;
+}
+
+//
+//	Scratchpad to EEPROM of one sensor
+//
+static void DS18B20_CopyConfig(Ds18b20Bus_t* bus, uint8_t number)
+{
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, ONEWIRE_CMD_CPYSCRATCHPAD); // Copy scratchpad to EEPROM
+	if (bus->Status[number] & DS18B20_STATUS_PARASITE)
+		OneWire_StrongPullup(&bus->OneWire, DS18B20_COPY_TIME);
+	DS18B20_CopyWait(bus);
+}
+
+//
+//	ROM order index for DS18B20_Find and the Match ROM frames - insertion
+//	sort, the table is built once per search
+//
+static void DS18B20_IndexTable(Ds18b20Bus_t* bus)
+{
+	uint8_t i, j, number;
+
+	for (i = 0; i < bus->SensorCount; i++)
+	{
+		number = i;
+		for (j = i; j > 0 && memcmp(bus->Address[bus->Sorted[j - 1]], bus->Address[number], 8) > 0; j--)
+			bus->Sorted[j] = bus->Sorted[j - 1];
+		bus->Sorted[j] = number;
+
+		OneWire_SelectFrame(bus->Select[i], bus->Address[i]);
+	}
+
+	bus->SingleDevice = 0; // Checked again on the bus
+}
+
+//
+//	Power supply - on Read Power Supply every parasite-powered sensor
+//	pulls the read slot low
+//
+static uint8_t DS18B20_IsParasite(Ds18b20Bus_t* bus, uint8_t number)
+{
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, ONEWIRE_CMD_RPWRSUPPLY); // Read power supply command
+
+	return !OneWire_ReadBit(&bus->OneWire);
+}
+
+static void DS18B20_SetParasite(Ds18b20Bus_t* bus, uint8_t number, uint8_t parasite)
+{
+	if (parasite && !(bus->Status[number] & DS18B20_STATUS_PARASITE))
+	{
+		bus->Status[number] |= DS18B20_STATUS_PARASITE;
+		bus->ParasiteCount++;
+	}
+	else if (!parasite && (bus->Status[number] & DS18B20_STATUS_PARASITE))
+	{
+		bus->Status[number] &= ~DS18B20_STATUS_PARASITE;
+		bus->ParasiteCount--;
+	}
+}
+
+//
+//	Parasite power detection - one Skip ROM query answers for the whole
+//	bus, only a low answer needs the sensor by sensor check
+//
+static void DS18B20_DetectPower(Ds18b20Bus_t* bus)
+{
+	uint8_t i;
+
+	bus->ParasiteCount = 0;
+	bus->ParasiteNext = 0;
+	for (i = 0; i < bus->SensorCount; i++)
+		bus->Status[i] &= ~DS18B20_STATUS_PARASITE;
+
+	if (!bus->SensorCount)
+		return;
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_SkipRom(bus, ONEWIRE_CMD_RPWRSUPPLY); // All sensors at once
+
+	if (OneWire_ReadBit(&bus->OneWire)) // Nobody pulled it low - all externally powered
+		return;
+
+	for (i = 0; i < bus->SensorCount; i++)
+	{
+		if (DS18B20_Is(bus->Address[i]))
+			DS18B20_SetParasite(bus, i, DS18B20_IsParasite(bus, i));
+	}
+}
+
+//
+//	Strong pull-up time of a Skip ROM conversion - the longest one among
+//	the parasite-powered sensors
+//
+static uint16_t DS18B20_ParasiteConversionTime(Ds18b20Bus_t* bus)
+{
+	uint16_t time, longest = 0;
+	uint8_t i;
+
+	for (i = 0; i < bus->SensorCount; i++)
+	{
+		if (!(bus->Status[i] & DS18B20_STATUS_PARASITE))
+			continue;
+
+		time = DS18B20_ConversionTime(DS18B20_KnownResolution(bus, i));
+		if (time > longest)
+			longest = time;
+	}
+
+	return longest;
+}
+
+//
+//	Milliseconds until @number sensor has its result, 0 - ready
+//
+uint32_t DS18B20_TimeToReady(Ds18b20Bus_t* bus, uint8_t number)
+{
+	uint32_t elapsed, time;
+
+	if (number >= bus->SensorCount)
+		return 0;
+
+	if (!(bus->Status[number] & DS18B20_STATUS_CONVERTING))
+		return 0;
+
+	elapsed = HAL_GetTick() - bus->ConversionStart[number];
+	time = DS18B20_ConversionTime(DS18B20_KnownResolution(bus, number)) + 1; // Start could be at the end of a tick
+
+	return (elapsed >= time) ? 0 : time - elapsed;
+}
+
+//
+//	Milliseconds until all sensors of the bus have their results, 0 - ready
+//
+uint32_t DS18B20_TimeToReadyAll(Ds18b20Bus_t* bus)
+{
+	uint32_t time, longest = 0;
+	uint8_t i;
+
+	for(i = 0; i < bus->SensorCount; i++)
+	{
+		time = DS18B20_TimeToReady(bus, i);
+		if (time > longest)
+			longest = time;
+	}
+
+	return longest;
+}
+
 //
 //	Start conversion of @number sensor
 //
-uint8_t DS18B20_Start(uint8_t number)
+uint8_t DS18B20_Start(Ds18b20Bus_t* bus, uint8_t number)
+{
+	if( number >= bus->SensorCount) // If read sensor is not availible
+		return 0;
+
+	if (!DS18B20_Is(bus->Address[number])) // Check if sensor is DS18B20 family
+		return 0;
+
+	if (!DS18B20_Powered(bus, number)) // Would convert on the pull-up resistor
+		return 0;
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, DS18B20_CMD_CONVERTTEMP); // Convert command
+	if (bus->Status[number] & DS18B20_STATUS_PARASITE) // Supply for the whole conversion
+		OneWire_StrongPullup(&bus->OneWire, DS18B20_ConversionTime(DS18B20_KnownResolution(bus, number)));
+	DS18B20_ConversionStarted(bus, number, HAL_GetTick());
+	
+	return 1;
+}
+
+//
+//	More parasite sensors than _DS18B20_PARASITE_MAX - Convert T sent to a
+//	selected parasite sensor cannot overlap another one, the next command
+//	would take its supply away. Externally powered sensors are started
+//	one by one, then one parasite sensor per call goes last on the strong
+//	pull-up. Without a strong pull-up the parasite sensors are not started.
+//
+static void DS18B20_StartInTurns(Ds18b20Bus_t* bus)
+{
+	uint8_t i, number;
+
+	for(i = 0; i < bus->SensorCount; i++)
+	{
+		if (!(bus->Status[i] & DS18B20_STATUS_PARASITE))
+			DS18B20_Start(bus, i);
+	}
+
+	for(i = 0; i < bus->SensorCount; i++)
+	{
+		number = (bus->ParasiteNext + i) % bus->SensorCount;
+		if ((bus->Status[number] & DS18B20_STATUS_PARASITE) && DS18B20_Start(bus, number))
+		{
+			bus->ParasiteNext = number + 1;
+			break;
+		}
+	}
+}
+
+//
+//	Start conversion on all sensors
+//
+void DS18B20_StartAll(Ds18b20Bus_t* bus)
+{
+	uint32_t tick;
+	uint16_t parasite;
+	uint8_t i;
+
+	if (!DS18B20_PoweredAll(bus)) // Too much current for the strong pull-up, or none
+	{
+		DS18B20_StartInTurns(bus);
+		return;
+	}
+
+	parasite = DS18B20_ParasiteConversionTime(bus); // Known before the command - pull-up goes on at once
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_SkipRom(bus, DS18B20_CMD_CONVERTTEMP); // Start conversion on all sensors
+	if (parasite)
+		OneWire_StrongPullup(&bus->OneWire, parasite);
+
+	tick = HAL_GetTick();
+	for(i = 0; i < bus->SensorCount; i++)
+		DS18B20_ConversionStarted(bus, i, tick);
+}
+
+//
+//	Scratchpad data to temperature in 1/16 degC
+//
+static int16_t DS18B20_Raw(const uint8_t* data)
+{
+	return (int16_t)(data[0] | (data[1] << 8)); // Signed 1/16 degC at every resolution
+}
+
+static int16_t DS18B20_Mask(int16_t temperature, uint8_t resolution)
+{
+	return temperature & ~((1 << (DS18B20_Resolution_12bits - resolution)) - 1); // Bits below the resolution are undefined
+}
+
+static uint8_t DS18B20_Decode(uint8_t* data, int16_t* destination)
+{
+	int16_t temperature;
+	uint8_t resolution;
+#ifdef _DS18B20_USE_CRC
+	uint8_t crc;
+
+	crc = OneWire_CRC8(data, 8); // CRC calculation
+
+	if (crc != data[8])
+		return 0; // CRC invalid
+#endif
+	if ((data[4] & 0x9F) != 0x1F) // Reserved bits - no answer
+		return 0;
+
+	temperature = DS18B20_Raw(data);
+	if (temperature == (int16_t)0xFFFF || temperature == DS18B20_POWER_ON) // Open bus, or no conversion since power-up
+		return 0;
+
+	resolution = ((data[4] & 0x60) >> 5) + 9; // Sensor's resolution from scratchpad's byte 4
+
+	*destination = DS18B20_Mask(temperature, resolution);
+	
+	return 1; //temperature valid
+}
+
+//
+//	Temperature read policy - every bus->VerifyEvery reads one reads the
+//	whole scratchpad
+//
+static uint8_t DS18B20_VerifyNext(Ds18b20Bus_t* bus)
+{
+	if (!bus->VerifyEvery || ++bus->VerifyCount < bus->VerifyEvery)
+		return 0;
+
+	bus->VerifyCount = 0;
+	return 1;
+}
+
+//
+//	Skip ROM reads of a single sensor get no address check - a sensor
+//	plugged in since DS18B20_Hotplug last looked would answer too and
+//	the wired-AND of both could pass as a temperature. Only the CRC of
+//	the whole scratchpad catches it.
+//
+static uint8_t DS18B20_FullRead(Ds18b20Bus_t* bus)
+{
+	return bus->SingleDevice || DS18B20_VerifyNext(bus);
+}
+
+//
+//	Check of an early-terminated read - a temperature that does not fit
+//	is read again with the whole scratchpad before it is taken
+//
+static uint8_t DS18B20_Plausible(Ds18b20Bus_t* bus, uint8_t number, int16_t temperature, int16_t previous, uint8_t valid)
+{
+	uint32_t elapsed = bus->ConversionStart[number] - bus->SampleTick[number];
+	int32_t change = temperature - previous;
+
+	if (temperature == (int16_t)0xFFFF || temperature == DS18B20_POWER_ON) // Open bus, or no conversion since power-up
+		return 0;
+
+	if (!valid)
+		return 1;
+
+	if (change < 0)
+		change = -change;
+	if (elapsed > 60000) // The whole range fits in a minute, no overflow below
+		elapsed = 60000;
+
+	return change <= (int32_t)(_DS18B20_VERIFY_RATE * elapsed / 1000) + 8; // Last reading may have been a 9 bit one
+}
+
+//
+//	Whole scratchpad - the CRC, and the reserved bits of the configuration
+//	register for an all zero frame with its good CRC
+//
+static uint8_t DS18B20_Verified(uint8_t* data)
+{
+	return OneWire_CRC8(data, 8) == data[8] && (data[4] & 0x9F) == 0x1F;
+}
+
+static void DS18B20_ReadScratchpad(Ds18b20Bus_t* bus, uint8_t number, uint8_t* data, uint8_t len)
+{
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, ONEWIRE_CMD_RSCRATCHPAD); // Read scratchpad command
+	OneWire_ReadBlock(&bus->OneWire, data, len);
+	OneWire_Reset(&bus->OneWire); // Rest of the scratchpad is not needed
+}
+
+//
+//	Read one sensor - @previous and @valid are its last reading for the
+//	plausibility check of a short read
+//
+static uint8_t DS18B20_ReadSensor(Ds18b20Bus_t* bus, uint8_t number, int16_t *destination, int16_t previous, uint8_t valid)
+{
+	if( number >= bus->SensorCount) // If read sensor is not availible
+		return 0;
+
+	uint8_t data[DS18B20_SCRATCHPAD_LEN];
+	uint8_t len;
+	
+	if (!DS18B20_Is(bus->Address[number])) // Check if sensor is DS18B20 family
+		return 0;
+
+	if (!DS18B20_Powered(bus, number)) // Never converted - power-on value in the scratchpad
+		return 0;
+
+	if (DS18B20_TimeToReady(bus, number)) // Conversion time not passed yet
+		return 0;
+
+	if (OneWire_PullupActive(&bus->OneWire)) // Parasite conversion or copy still powered
+		return 0;
+
+	if (!OneWire_ReadBit(&bus->OneWire)) // Check if the bus is released
+		return 0; // Busy bus - conversion is not finished
+
+	len = DS18B20_FullRead(bus) ? DS18B20_SCRATCHPAD_LEN : DS18B20_TEMPERATURE_LEN; // Only reads that go out count
+	DS18B20_ReadScratchpad(bus, number, data, len);
+
+	if (len == DS18B20_TEMPERATURE_LEN && !DS18B20_Plausible(bus, number, DS18B20_Raw(data), previous, valid))
+	{
+		len = DS18B20_SCRATCHPAD_LEN; // Once more with the CRC
+		DS18B20_ReadScratchpad(bus, number, data, len);
+	}
+
+	if (len == DS18B20_SCRATCHPAD_LEN)
+	{
+		if (!DS18B20_Verified(data))
+			return 0;
+		DS18B20_SetKnownResolution(bus, number, DS18B20_ConfigResolution(data[4])); // Keep the known resolution up to date
+	}
+
+	*destination = DS18B20_Mask(DS18B20_Raw(data), DS18B20_KnownResolution(bus, number));
+	bus->Status[number] &= ~DS18B20_STATUS_CONVERTING;
+
+	return 1;
+}
+
+//
+//	Read of one sensor outside the table calls - the reading goes to the
+//	table too, so the rate check of the next one measures from it
+//
+uint8_t DS18B20_Read(Ds18b20Bus_t* bus, uint8_t number, int16_t *destination)
+{
+	if (number >= bus->SensorCount)
+		return 0;
+
+	if (!DS18B20_ReadSensor(bus, number, destination, bus->Temperature[number], bus->Status[number] & DS18B20_STATUS_VALID))
+		return 0;
+
+	bus->Temperature[number] = *destination;
+	bus->Status[number] |= DS18B20_STATUS_VALID;
+	bus->SampleTick[number] = bus->ConversionStart[number];
+
+	return 1;
+}
+
+uint8_t DS18B20_GetResolution(Ds18b20Bus_t* bus, uint8_t number)
+{
+	if( number >= bus->SensorCount)
+		return 0;
+
+	uint8_t conf;
+	uint8_t data[5];
+	
+	if (!DS18B20_Is(bus->Address[number]))
+		return 0;
+	
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, ONEWIRE_CMD_RSCRATCHPAD); // Read scratchpad command
+	OneWire_ReadBlock(&bus->OneWire, data, sizeof(data));
+	
+	conf = data[4]; // Register 5 is the configuration register with resolution
+	conf &= 0x60; // Mask two resolution bits
+	conf >>= 5; // Shift to left
+	conf += 9; // Get the result in number of resolution bits
+	DS18B20_SetKnownResolution(bus, number, conf);
+	
+	return conf;
+}
+
+//
+//	Resolution of one sensor - nothing goes to the bus when it is set
+//	already, the EEPROM is written only when its value changes
+//
+uint8_t DS18B20_SetResolution(Ds18b20Bus_t* bus, uint8_t number, DS18B20_Resolution_t resolution)
+{
+	if( number >= bus->SensorCount)
+		return 0;
+
+	uint8_t conf = DS18B20_ConfigRegister(resolution);
+	if (!DS18B20_Is(bus->Address[number]) || !DS18B20_CacheConfig(bus, number))
+		return 0;
+
+	if (bus->Config[number][2] == conf && DS18B20_KnownResolution(bus, number) == resolution)
+		return 1; // Set already
+
+	if (bus->Config[number][2] != conf && !DS18B20_Powered(bus, number))
+		return 0; // EEPROM copy needs the strong pull-up
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, ONEWIRE_CMD_WSCRATCHPAD); // Write scratchpad command
+	DS18B20_WriteScratchpad(bus, bus->Config[number][0], bus->Config[number][1], conf); // Write 3 bytes to scratchpad, thresholds from the cache
+	bus->Status[number] &= ~DS18B20_STATUS_BAND; // EEPROM thresholds are back
+
+	if (bus->Config[number][2] != conf)
+	{
+		DS18B20_CopyConfig(bus, number);
+		bus->Config[number][2] = conf;
+	}
+	DS18B20_SetKnownResolution(bus, number, resolution);
+	
+	return 1;
+}
+
+//
+//	Same resolution on all sensors - one Skip ROM write when every sensor
+//	needs it, they share TH/TL and nothing else is on the bus, only the
+//	changed sensors otherwise
+//
+void DS18B20_SetResolutionAll(Ds18b20Bus_t* bus, DS18B20_Resolution_t resolution)
+{
+	uint8_t i, conf = DS18B20_ConfigRegister(resolution);
+
+	for(i = 0; i < bus->SensorCount; i++)
+	{
+		if (!DS18B20_Is(bus->Address[i]) || !DS18B20_CacheConfig(bus, i) || bus->Config[i][2] == conf)
+			break;
+		if (bus->Config[i][0] != bus->Config[0][0] || bus->Config[i][1] != bus->Config[0][1])
+			break;
+	}
+
+	if (!bus->SensorCount || i < bus->SensorCount || !DS18B20_PoweredAll(bus) || !DS18B20_SkipRomWritable(bus)) // Not all of them change, too much EEPROM current or other devices
+	{
+		for(i = 0; i < bus->SensorCount; i++)
+			DS18B20_SetResolution(bus, i, resolution);
+		return;
+	}
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_SkipRom(bus, ONEWIRE_CMD_WSCRATCHPAD); // All sensors at once
+	DS18B20_WriteScratchpad(bus, bus->Config[0][0], bus->Config[0][1], conf);
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_SkipRom(bus, ONEWIRE_CMD_CPYSCRATCHPAD); // Copy scratchpad to EEPROM
+	if (bus->ParasiteCount)
+		OneWire_StrongPullup(&bus->OneWire, DS18B20_COPY_TIME);
+	DS18B20_CopyWait(bus);
+
+	for(i = 0; i < bus->SensorCount; i++)
+	{
+		bus->Config[i][2] = conf;
+		bus->Status[i] &= ~DS18B20_STATUS_BAND;
+		DS18B20_SetKnownResolution(bus, i, resolution);
+	}
+}
+
+//
+//	Adaptive resolution after a new reading of @number - rate of change
+//	since the last one in 1/16 degC per second, less the rounding of
+//	both readings. Sensors moving fast drop to bus->AdaptiveMin, settled
+//	ones go one step per reading back to bus->Resolution. Arithmetic
+//	only, runs in the read interrupt too.
+//
+//	Returns:
+//	Resolution for the next conversion
+//
+static uint8_t DS18B20_Adapt(Ds18b20Bus_t* bus, uint8_t number, int16_t previous, uint8_t valid)
+{
+	uint8_t resolution = DS18B20_KnownResolution(bus, number);
+	uint32_t elapsed = bus->ConversionStart[number] - bus->SampleTick[number];
+	int32_t change = bus->Temperature[number] - previous;
+	int32_t rounding = 2 << (DS18B20_Resolution_12bits - resolution); // Last reading may have been one step coarser
+
+	bus->SampleTick[number] = bus->ConversionStart[number];
+
+	if (!bus->AdaptiveMin || !valid || !elapsed)
+		return resolution;
+
+	if (rounding > 8) // 0.5 degC - 9 bit on both sides
+		rounding = 8;
+	if (change < 0)
+		change = -change;
+	change = (change > rounding) ? (change - rounding) * 1000 / (int32_t)elapsed : 0;
+
+	if (change >= _DS18B20_ADAPTIVE_FAST)
+		return bus->AdaptiveMin;
+	if (change <= _DS18B20_ADAPTIVE_SLOW && resolution < bus->Resolution)
+		return resolution + 1;
+
+	return resolution;
+}
+
+//
+//	Resolution to the scratchpad only - the EEPROM keeps the one set by
+//	DS18B20_SetResolution and a power cycle goes back to it
+//
+static void DS18B20_WriteResolution(Ds18b20Bus_t* bus, uint8_t number, uint8_t resolution)
+{
+	if (resolution == DS18B20_KnownResolution(bus, number) || !DS18B20_CacheConfig(bus, number))
+		return;
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, ONEWIRE_CMD_WSCRATCHPAD); // Write scratchpad command
+	DS18B20_WriteScratchpad(bus, bus->Config[number][0], bus->Config[number][1], DS18B20_ConfigRegister(resolution));
+	bus->Status[number] &= ~DS18B20_STATUS_BAND;
+	DS18B20_SetKnownResolution(bus, number, resolution);
+}
+
+//
+//	Adaptive mode - every sensor read by ReadAll, ReadChanged or the async
+//	reads gets a resolution between @fastest and bus->Resolution from its
+//	rate of change, written to the scratchpad. 0 switches it off and puts
+//	bus->Resolution back.
+//
+void DS18B20_SetAdaptive(Ds18b20Bus_t* bus, uint8_t fastest)
+{
+	if (fastest < DS18B20_Resolution_9bits || fastest >= bus->Resolution)
+		fastest = 0; // Nothing to adapt
+
+	bus->AdaptiveMin = fastest;
+
+	if (!fastest)
+		DS18B20_SetResolutionAll(bus, bus->Resolution); // Scratchpad only, the EEPROM has it
+}
+
+//
+//	Temperature read policy - @every 1 reads the whole scratchpad with its
+//	CRC every time, N one read in N, 0 only the values that do not fit
+//
+void DS18B20_SetVerify(Ds18b20Bus_t* bus, uint8_t every)
+{
+	bus->VerifyEvery = every;
+	bus->VerifyCount = 0;
+}
+
+//
+//	Alarm thresholds - compared with the whole degrees of every conversion,
+//	the sensor answers the alarm search when T >= TH or T <= TL. Written
+//	to the scratchpad with the EEPROM resolution, copied to EEPROM only
+//	when they change.
+//
+uint8_t DS18B20_SetAlarm(Ds18b20Bus_t* bus, uint8_t number, int8_t th, int8_t tl)
+{
+	if( number >= bus->SensorCount)
+		return 0;
+
+	if (!DS18B20_Is(bus->Address[number]) || !DS18B20_CacheConfig(bus, number))
+		return 0;
+
+	if (bus->Config[number][0] == (uint8_t)th && bus->Config[number][1] == (uint8_t)tl &&
+			!(bus->Status[number] & DS18B20_STATUS_BAND) && DS18B20_KnownResolution(bus, number) == DS18B20_ConfigResolution(bus->Config[number][2]))
+		return 1; // Scratchpad and EEPROM have them already
+
+	if ((bus->Config[number][0] != (uint8_t)th || bus->Config[number][1] != (uint8_t)tl) && !DS18B20_Powered(bus, number))
+		return 0; // EEPROM copy needs the strong pull-up
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, ONEWIRE_CMD_WSCRATCHPAD); // Write scratchpad command
+	DS18B20_WriteScratchpad(bus, (uint8_t)th, (uint8_t)tl, bus->Config[number][2]); // Cached configuration, no scratchpad read
+	bus->Status[number] &= ~DS18B20_STATUS_BAND;
+	DS18B20_SetKnownResolution(bus, number, DS18B20_ConfigResolution(bus->Config[number][2]));
+
+	if (bus->Config[number][0] != (uint8_t)th || bus->Config[number][1] != (uint8_t)tl)
+	{
+		DS18B20_CopyConfig(bus, number);
+		bus->Config[number][0] = (uint8_t)th;
+		bus->Config[number][1] = (uint8_t)tl;
+	}
+
+	return 1;
+}
+
+//
+//	Same thresholds on all sensors - one Skip ROM write when every sensor
+//	needs them, all have the same configuration and nothing else is on
+//	the bus, sensor by sensor otherwise
+//
+void DS18B20_SetAlarmAll(Ds18b20Bus_t* bus, int8_t th, int8_t tl)
+{
+	uint8_t i;
+
+	for(i = 0; i < bus->SensorCount; i++)
+	{
+		if (!DS18B20_Is(bus->Address[i]) || !DS18B20_CacheConfig(bus, i) || bus->Config[i][2] != bus->Config[0][2])
+			break;
+		if (bus->Config[i][0] == (uint8_t)th && bus->Config[i][1] == (uint8_t)tl) // This one has them already
+			break;
+	}
+
+	if (!bus->SensorCount || i < bus->SensorCount || !DS18B20_PoweredAll(bus) || !DS18B20_SkipRomWritable(bus)) // Configuration differs, too much EEPROM current or other devices
+	{
+		for(i = 0; i < bus->SensorCount; i++)
+			DS18B20_SetAlarm(bus, i, th, tl);
+		return;
+	}
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_SkipRom(bus, ONEWIRE_CMD_WSCRATCHPAD); // All sensors at once
+	DS18B20_WriteScratchpad(bus, (uint8_t)th, (uint8_t)tl, bus->Config[0][2]);
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_SkipRom(bus, ONEWIRE_CMD_CPYSCRATCHPAD); // Copy scratchpad to EEPROM
+	if (bus->ParasiteCount)
+		OneWire_StrongPullup(&bus->OneWire, DS18B20_COPY_TIME);
+	DS18B20_CopyWait(bus);
+
+	for(i = 0; i < bus->SensorCount; i++)
+	{
+		DS18B20_SetConfig(bus, i, (uint8_t)th, (uint8_t)tl, bus->Config[0][2]);
+		bus->Status[i] &= ~DS18B20_STATUS_BAND;
+		DS18B20_SetKnownResolution(bus, i, DS18B20_ConfigResolution(bus->Config[0][2]));
+	}
+}
+
+//
+//	Alarm search - only sensors whose last conversion was out of TH/TL
+//	answer, so the bus time depends on the alarms, not on the sensor
+//	count. Sets DS18B20_STATUS_ALARM of the found sensors and clears it
+//	on the others. Do not call while a conversion is running.
+//
+//	Returns:
+//	Sensors in alarm, the first @max of their numbers go to @numbers
+//
+uint8_t DS18B20_AlarmScan(Ds18b20Bus_t* bus, uint8_t* numbers, uint8_t max)
+{
+	uint8_t next, number, count = 0, i;
+
+	for(i = 0; i < bus->SensorCount; i++)
+		bus->Status[i] &= ~DS18B20_STATUS_ALARM;
+
+	OneWire_TargetSetup(&bus->OneWire, DS18B20_FAMILY_CODE); // Only the DS18B20 branch
+	next = OneWire_Search(&bus->OneWire, DS18B20_CMD_ALARMSEARCH);
+	while(next && DS18B20_Is(bus->OneWire.ROM_NO))
+	{
+		number = DS18B20_Find(bus, bus->OneWire.ROM_NO);
+		if (number != DS18B20_NOT_FOUND) // Sensors out of the table are skipped
+		{
+			bus->Status[number] |= DS18B20_STATUS_ALARM;
+			if (numbers && count < max)
+				numbers[count] = number;
+			count++;
+		}
+
+		if (bus->OneWire.LastDiscrepancy <= 8) // No other DS18B20 in alarm
+			break;
+		next = OneWire_Search(&bus->OneWire, DS18B20_CMD_ALARMSEARCH);
+	}
+
+	return count;
+}
+
+//
+//	TH/TL band around the last reading of @number - scratchpad only, the
+//	EEPROM keeps the thresholds set by DS18B20_SetAlarm
+//
+static void DS18B20_SetBand(Ds18b20Bus_t* bus, uint8_t number)
+{
+	int16_t whole = DS18B20_ToWholeCelsius(bus->Temperature[number]);
+	int16_t th = whole + _DS18B20_CHANGE_BAND;
+	int16_t tl = whole - _DS18B20_CHANGE_BAND;
+
+	if (th > INT8_MAX)
+		th = INT8_MAX;
+	if (tl < INT8_MIN)
+		tl = INT8_MIN;
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_Select(bus, number, ONEWIRE_CMD_WSCRATCHPAD); // Write scratchpad command
+	DS18B20_WriteScratchpad(bus, (uint8_t)th, (uint8_t)tl, DS18B20_ConfigRegister(DS18B20_KnownResolution(bus, number)));
+
+	bus->Status[number] |= DS18B20_STATUS_BAND;
+}
+
+//
+//	Change-driven read - call when the conversion started by StartAll is
+//	done. Every sensor keeps a TH/TL band of _DS18B20_CHANGE_BAND degrees
+//	around its last reading, the alarm search finds the ones that left it
+//	and only those are read and get a new band. The others keep their
+//	last Temperature. Every _DS18B20_CHANGE_REFRESH calls all sensors are
+//	read again, a sensor that is gone never shows up in the alarm search.
+//
+//	Returns:
+//	Sensors read with a valid temperature, failed reads are not counted
+//
+uint8_t DS18B20_ReadChanged(Ds18b20Bus_t* bus)
+{
+	uint8_t i, valid, banded = 0, count = 0;
+	int16_t previous;
+
+	if (DS18B20_TimeToReadyAll(bus) || !DS18B20_AllDone(bus))
+		return 0; // Conversion not finished
+
+	if (++bus->ChangeCycle >= _DS18B20_CHANGE_REFRESH)
+	{
+		bus->ChangeCycle = 0;
+		for(i = 0; i < bus->SensorCount; i++)
+			bus->Status[i] &= ~DS18B20_STATUS_BAND;
+	}
+
+	for(i = 0; i < bus->SensorCount; i++)
+		banded |= bus->Status[i];
+
+	if (banded & DS18B20_STATUS_BAND) // Nothing to search for when every sensor is read anyway
+		DS18B20_AlarmScan(bus, NULL, 0);
+
+	for(i = 0; i < bus->SensorCount; i++)
+	{
+		if ((bus->Status[i] & (DS18B20_STATUS_BAND | DS18B20_STATUS_ALARM)) == DS18B20_STATUS_BAND) // Still in its band
+		{
+			bus->Status[i] &= ~DS18B20_STATUS_CONVERTING;
+			continue;
+		}
+
+		previous = bus->Temperature[i];
+		valid = bus->Status[i] & DS18B20_STATUS_VALID;
+		bus->Status[i] &= ~(DS18B20_STATUS_VALID | DS18B20_STATUS_BAND);
+
+		if (!DS18B20_Is(bus->Address[i]))
+			continue;
+
+		if (DS18B20_ReadSensor(bus, i, &bus->Temperature[i], previous, valid))
+		{
+			bus->Status[i] |= DS18B20_STATUS_VALID;
+			DS18B20_SetKnownResolution(bus, i, DS18B20_Adapt(bus, i, previous, valid)); // Goes out with the band
+			DS18B20_SetBand(bus, i);
+			count++;
+		}
+	}
+
+	return count;
+}
+
+uint8_t DS18B20_Is(uint8_t* ROM)
+{
+	if (*ROM == DS18B20_FAMILY_CODE) // Check family code
+		return 1;
+	return 0;
+}
+
+uint8_t DS18B20_AllDone(Ds18b20Bus_t* bus)
+{
+	if (OneWire_PullupActive(&bus->OneWire)) // Parasite sensors cannot signal, the pull-up time tells
+		return 0;
+
+	return OneWire_ReadBit(&bus->OneWire); // Bus is down - busy
+}
+
+void DS18B20_ReadAll(Ds18b20Bus_t* bus)
+{
+	uint8_t i, valid;
+	int16_t previous;
+
+	if (DS18B20_AllDone(bus))
+	{
+		for(i = 0; i < bus->SensorCount; i++) // All detected sensors loop
+		{
+			previous = bus->Temperature[i];
+			valid = bus->Status[i] & DS18B20_STATUS_VALID;
+			bus->Status[i] &= ~DS18B20_STATUS_VALID;
+
+			if (DS18B20_Is(bus->Address[i]) && DS18B20_ReadSensor(bus, i, &bus->Temperature[i], previous, valid)) // Read single sensor
+			{
+				bus->Status[i] |= DS18B20_STATUS_VALID;
+				DS18B20_WriteResolution(bus, i, DS18B20_Adapt(bus, i, previous, valid));
+			}
+		}
+	}
+}
+
+//
+//	Non-blocking versions - bus work runs in the timer interrupt
+//
+static void DS18B20_StartDone(OneWireAsync_t* transaction)
+{
+	Ds18b20Bus_t* bus = transaction->Context;
+	uint32_t tick = HAL_GetTick(); // Conversion runs from the last bit of Convert T
+	uint8_t i;
+
+	if (transaction->Status != ONEWIRE_ASYNC_DONE)
+		return;
+
+	if (bus->ParasiteCount) // Interrupt comes right after the last bit
+		OneWire_StrongPullup(&bus->OneWire, DS18B20_ParasiteConversionTime(bus));
+
+	for(i = 0; i < bus->SensorCount; i++)
+		DS18B20_ConversionStarted(bus, i, tick);
+}
+
+uint8_t DS18B20_StartAllAsync(Ds18b20Bus_t* bus)
+{
+	OneWireAsync_t* transaction = &bus->StartTransaction;
+
+	if (!DS18B20_PoweredAll(bus) || OneWire_PullupActive(&bus->OneWire))
+		return 0; // Sensors take turns or the bus is powering them - blocking calls only
+
+	transaction->onewire = &bus->OneWire;
+	transaction->Reset = 1;
+	transaction->TxData = StartCommand; // Skip ROM, Convert T
+	transaction->TxLen = sizeof(StartCommand);
+	transaction->RxLen = 0;
+	transaction->Callback = DS18B20_StartDone;
+	transaction->Context = bus;
+
+	return OneWireAsync_Submit(transaction);
+}
+
+//
+//	Function @command of @number on the read transaction - the Match ROM
+//	frame is sent from the sensor table, Skip ROM goes in ReadCommand
+//
+static void DS18B20_SelectAsync(Ds18b20Bus_t* bus, uint8_t number, uint8_t command)
+{
+	OneWireAsync_t* transaction = &bus->ReadTransaction;
+
+	bus->ReadNumber = number;
+
+	if (bus->SingleDevice)
+	{
+		bus->ReadCommand[0] = ONEWIRE_CMD_SKIPROM;
+		bus->ReadCommand[1] = command;
+		transaction->TxData = bus->ReadCommand;
+		transaction->TxLen = 2;
+		return;
+	}
+
+	bus->Select[number][ONEWIRE_SELECT_LEN] = command;
+	transaction->TxData = bus->Select[number];
+	transaction->TxLen = DS18B20_SELECT_LEN;
+}
+
+//
+//	Scratchpad read of @number on the read transaction, @callback gets it
+//
+static uint8_t DS18B20_SubmitRead(Ds18b20Bus_t* bus, uint8_t number, void (*callback)(OneWireAsync_t* transaction))
+{
+	OneWireAsync_t* transaction = &bus->ReadTransaction;
+	uint8_t count = bus->VerifyCount;
+
+	DS18B20_SelectAsync(bus, number, ONEWIRE_CMD_RSCRATCHPAD);
+
+	transaction->onewire = &bus->OneWire;
+	transaction->Reset = 1;
+	transaction->RxData = bus->ReadData;
+	transaction->RxLen = DS18B20_FullRead(bus) ? DS18B20_SCRATCHPAD_LEN : DS18B20_TEMPERATURE_LEN;
+	transaction->Callback = callback;
+	transaction->Context = bus;
+
+	if (OneWireAsync_Submit(transaction))
+		return 1;
+
+	bus->VerifyCount = count; // Nothing went out, the sampled read stays due
+	return 0;
+}
+
+//
+//	Adaptive resolution of the sensor just read - Write Scratchpad on the
+//	same transaction. Cached TH/TL only, no bus work to fill the cache
+//	from the interrupt.
+//
+static uint8_t DS18B20_WriteNext(Ds18b20Bus_t* bus, uint8_t number, uint8_t resolution, void (*callback)(OneWireAsync_t* transaction))
+{
+	OneWireAsync_t* transaction = &bus->ReadTransaction;
+
+	if (resolution == DS18B20_KnownResolution(bus, number) || !(bus->Status[number] & DS18B20_STATUS_CONFIG))
+		return 0;
+
+	DS18B20_SelectAsync(bus, number, ONEWIRE_CMD_WSCRATCHPAD);
+	memmove(bus->ReadCommand, transaction->TxData, transaction->TxLen); // Data bytes follow the command
+	bus->ReadCommand[transaction->TxLen] = bus->Config[number][0];
+	bus->ReadCommand[transaction->TxLen + 1] = bus->Config[number][1];
+	bus->ReadCommand[transaction->TxLen + 2] = DS18B20_ConfigRegister(resolution);
+
+	transaction->TxData = bus->ReadCommand;
+	transaction->TxLen += 3;
+	transaction->RxLen = 0;
+	transaction->Callback = callback;
+
+	if (!OneWireAsync_Submit(transaction))
+		return 0;
+
+	bus->Status[number] &= ~DS18B20_STATUS_BAND;
+	DS18B20_SetKnownResolution(bus, number, resolution);
+
+	return 1;
+}
+
+//
+//	Finished scratchpad read of bus->ReadNumber into the sensor table
+//
+//	Returns:
+//	1 - Adaptive resolution write queued, @next is called after it, or
+//	    the whole scratchpad read queued, the read callback comes again
+//
+static uint8_t DS18B20_ReadResult(OneWireAsync_t* transaction, void (*next)(OneWireAsync_t* transaction))
+{
+	Ds18b20Bus_t* bus = transaction->Context;
+	uint8_t number = bus->ReadNumber;
+	uint8_t valid = bus->Status[number] & DS18B20_STATUS_VALID;
+	int16_t previous = bus->Temperature[number];
+	int16_t temperature = DS18B20_Raw(bus->ReadData);
+	uint8_t plausible = 1;
+
+	if (transaction->Status == ONEWIRE_ASYNC_DONE && transaction->RxLen == DS18B20_TEMPERATURE_LEN)
+	{
+		plausible = DS18B20_Plausible(bus, number, temperature, previous, valid);
+		transaction->RxLen = DS18B20_SCRATCHPAD_LEN;
+		if (!plausible && OneWireAsync_Submit(transaction)) // Same frame once more with the CRC
+			return 1;
+		transaction->RxLen = DS18B20_TEMPERATURE_LEN;
+	}
+
+	bus->Status[number] &= ~DS18B20_STATUS_VALID;
+
+	if (transaction->Status != ONEWIRE_ASYNC_DONE || !plausible)
+		return 0;
+
+	if (transaction->RxLen == DS18B20_SCRATCHPAD_LEN)
+	{
+		if (!DS18B20_Verified(bus->ReadData))
+			return 0;
+		DS18B20_SetKnownResolution(bus, number, DS18B20_ConfigResolution(bus->ReadData[4]));
+	}
+
+	bus->Temperature[number] = DS18B20_Mask(temperature, DS18B20_KnownResolution(bus, number));
+	bus->Status[number] |= DS18B20_STATUS_VALID;
+	bus->Status[number] &= ~DS18B20_STATUS_CONVERTING;
+
+	return DS18B20_WriteNext(bus, number, DS18B20_Adapt(bus, number, previous, valid), next);
+}
+
+//
+//	Scratchpad reads run one sensor after another on one transaction -
+//	every callback queues the read of the next sensor
+//
+static void DS18B20_ReadDone(OneWireAsync_t* transaction);
+
+static uint8_t DS18B20_ReadNext(Ds18b20Bus_t* bus, uint8_t number)
+{
+	while (number < bus->SensorCount && (!DS18B20_Is(bus->Address[number]) || !DS18B20_Powered(bus, number)))
+		number++;
+
+	if (number >= bus->SensorCount)
+		return 0; // All sensors read
+
+	return DS18B20_SubmitRead(bus, number, DS18B20_ReadDone);
+}
+
+static void DS18B20_WriteDone(OneWireAsync_t* transaction)
+{
+	Ds18b20Bus_t* bus = transaction->Context;
+
+	DS18B20_ReadNext(bus, bus->ReadNumber + 1);
+}
+
+static void DS18B20_ReadDone(OneWireAsync_t* transaction)
+{
+	if (!DS18B20_ReadResult(transaction, DS18B20_WriteDone))
+		DS18B20_WriteDone(transaction); // Next read right away
+}
+
+uint8_t DS18B20_ReadAllAsync(Ds18b20Bus_t* bus)
+{
+	if (DS18B20_AsyncBusy(bus) || OneWire_PullupActive(&bus->OneWire))
+		return 0; // Previous reads are not finished, parasite sensors still powered
+
+	return DS18B20_ReadNext(bus, 0); // 0 also when the bus has no GPIO pin
+}
+
+uint8_t DS18B20_AsyncBusy(Ds18b20Bus_t* bus)
+{
+	if (bus->StartTransaction.Status == ONEWIRE_ASYNC_PENDING)
+		return 1;
+
+	return bus->ReadTransaction.Status == ONEWIRE_ASYNC_PENDING;
+}
+
+//
+//	Scheduler - call from the main loop. Starts a conversion, reads the
+//	sensors as soon as their conversion time passed and starts the next
+//	one. Non-blocking on the GPIO bus, other transports fall back to the
+//	blocking calls.
+//
+//	Returns:
+//	1 - New results in the sensor table
+//	0 - Nothing new
+//
+uint8_t DS18B20_Poll(Ds18b20Bus_t* bus)
 {
-	if( number >= TempSensorCount) // If read sensor is not availible
+	switch (bus->PollState)
+	{
+	case DS18B20_POLL_IDLE:
+		if (!DS18B20_StartAllAsync(bus))
+			DS18B20_StartAll(bus);
+		bus->PollState = DS18B20_POLL_CONVERTING;
 		return 0;
 
-	if (!DS18B20_Is((uint8_t*)&ds18b20[number].Address)) // Check if sensor is DS18B20 family
+	case DS18B20_POLL_CONVERTING:
+		if (DS18B20_AsyncBusy(bus) || DS18B20_TimeToReadyAll(bus) || OneWire_PullupActive(&bus->OneWire))
+			return 0; // Convert T not sent yet or results not due
+
+		if (!DS18B20_ReadAllAsync(bus))
+		{
+			DS18B20_ReadAll(bus);
+			bus->PollState = DS18B20_POLL_IDLE;
+			return 1;
+		}
+		bus->PollState = DS18B20_POLL_READING;
 		return 0;
 
-	OneWire_Reset(&OneWire); // Reset the bus
-	OneWire_SelectWithPointer(&OneWire, (uint8_t*)ds18b20[number].Address); // Select the sensor by ROM
-	OneWire_WriteByte(&OneWire, DS18B20_CMD_CONVERTTEMP); // Convert command
-	
-	return 1;
+	case DS18B20_POLL_READING:
+	default:
+		if (DS18B20_AsyncBusy(bus))
+			return 0;
+		bus->PollState = DS18B20_POLL_IDLE;
+		return 1;
+	}
 }
 
 //
-//	Start conversion on all sensors
+//	Staggered scheduler - async steps of one sensor
 //
-void DS18B20_StartAll()
+static void DS18B20_StaggerReadDone(OneWireAsync_t* transaction)
+{
+	Ds18b20Bus_t* bus = transaction->Context;
+
+	DS18B20_ReadResult(transaction, NULL);
+	bus->Status[bus->ReadNumber] &= ~DS18B20_STATUS_CONVERTING; // Failed read too - started again in its slot
+}
+
+static void DS18B20_StaggerStartDone(OneWireAsync_t* transaction)
+{
+	Ds18b20Bus_t* bus = transaction->Context;
+
+	if (transaction->Status == ONEWIRE_ASYNC_DONE)
+		DS18B20_ConversionStarted(bus, bus->ReadNumber, HAL_GetTick()); // Conversion runs from the last bit
+}
+
+static uint8_t DS18B20_StaggerStart(Ds18b20Bus_t* bus, uint8_t number)
+{
+	OneWireAsync_t* transaction = &bus->ReadTransaction;
+
+	DS18B20_SelectAsync(bus, number, DS18B20_CMD_CONVERTTEMP);
+
+	transaction->onewire = &bus->OneWire;
+	transaction->Reset = 1;
+	transaction->RxLen = 0;
+	transaction->Callback = DS18B20_StaggerStartDone;
+	transaction->Context = bus;
+
+	if (OneWireAsync_Submit(transaction))
+		return 1;
+
+	return DS18B20_Start(bus, number); // Blocking transport
+}
+
+static uint8_t DS18B20_StaggerRead(Ds18b20Bus_t* bus, uint8_t number)
 {
-	OneWire_Reset(&OneWire); // Reset the bus
-	OneWire_WriteByte(&OneWire, ONEWIRE_CMD_SKIPROM); // Skip ROM command
-	OneWire_WriteByte(&OneWire, DS18B20_CMD_CONVERTTEMP); // Start conversion on all sensors
+	uint8_t valid = bus->Status[number] & DS18B20_STATUS_VALID;
+	int16_t previous = bus->Temperature[number];
+
+	if (DS18B20_SubmitRead(bus, number, DS18B20_StaggerReadDone))
+	{
+		bus->PollState = DS18B20_POLL_READING;
+		return 0; // Result comes with the interrupt
+	}
+
+	OneWire_Reset(&bus->OneWire); // Blocking transport - end the status slots of the sensor started last
+	bus->Status[number] &= ~DS18B20_STATUS_VALID;
+	if (DS18B20_ReadSensor(bus, number, &bus->Temperature[number], previous, valid))
+	{
+		bus->Status[number] |= DS18B20_STATUS_VALID;
+		DS18B20_WriteResolution(bus, number, DS18B20_Adapt(bus, number, previous, valid));
+	}
+	bus->Status[number] &= ~DS18B20_STATUS_CONVERTING;
+
+	return 1;
 }
 
 //
-//	Read one sensor
+//	Staggered scheduler - call from the main loop instead of DS18B20_Poll.
+//	Every sensor converts on its own Match ROM Convert T. A sensor whose
+//	conversion time passed is read while the others go on converting,
+//	and sensors waiting for a new conversion are started in the order
+//	they were read, one conversion time / sensor count apart. The bus
+//	keeps working and the ages of the readings spread over the cycle.
+//	Parasite sensors need the strong pull-up through the conversion, so
+//	with any of them on the bus this is DS18B20_Poll.
 //
-uint8_t DS18B20_Read(uint8_t number, float *destination)
+//	Returns:
+//	1 - New result of a sensor in the table
+//	0 - Nothing new
+//
+uint8_t DS18B20_PollStaggered(Ds18b20Bus_t* bus)
 {
-	if( number >= TempSensorCount) // If read sensor is not availible
-		return 0;
-
-	uint16_t temperature;
-	uint8_t resolution;
-	float result;
-	uint8_t i = 0;
-	uint8_t data[DS18B20_DATA_LEN];
-#ifdef _DS18B20_USE_CRC
-	uint8_t crc;
+	uint32_t tick = HAL_GetTick();
+	uint8_t i, number, waiting = DS18B20_NOT_FOUND;
 
-#endif
+	if (bus->ParasiteCount)
+		return DS18B20_Poll(bus);
 
-	
-	if (!DS18B20_Is((uint8_t*)&ds18b20[number].Address)) // Check if sensor is DS18B20 family
+	if (DS18B20_AsyncBusy(bus))
 		return 0;
 
-	if (!OneWire_ReadBit(&OneWire)) // Check if the bus is released
-		return 0; // Busy bus - conversion is not finished
+	if (bus->PollState == DS18B20_POLL_READING) // Async read finished
+	{
+		bus->PollState = DS18B20_POLL_CONVERTING;
+		return 1;
+	}
 
-	OneWire_Reset(&OneWire); // Reset the bus
-	OneWire_SelectWithPointer(&OneWire, (uint8_t*)&ds18b20[number].Address); // Select the sensor by ROM
-	OneWire_WriteByte(&OneWire, ONEWIRE_CMD_RSCRATCHPAD); // Read scratchpad command
-	
-	for (i = 0; i < DS18B20_DATA_LEN; i++) // Read scratchpad
-		data[i] = OneWire_ReadByte(&OneWire);
-	
-#ifdef _DS18B20_USE_CRC
-	crc = OneWire_CRC8(data, 8); // CRC calculation
+	for(i = 0; i < bus->SensorCount; i++)
+	{
+		number = (bus->StaggerNext + i) % bus->SensorCount;
 
-	if (crc != data[8])
-		return 0; // CRC invalid
-#endif
-	temperature = data[0] | (data[1] << 8); // Temperature is 16-bit length
+		if (!DS18B20_Is(bus->Address[number]))
+			continue;
 
-	OneWire_Reset(&OneWire); // Reset the bus
-	
-	resolution = ((data[4] & 0x60) >> 5) + 9; // Sensor's resolution from scratchpad's byte 4
+		if (!(bus->Status[number] & DS18B20_STATUS_CONVERTING)) // Longest waiting one goes first
+		{
+			if (waiting == DS18B20_NOT_FOUND || (int32_t)(bus->ConversionStart[number] - bus->ConversionStart[waiting]) < 0)
+				waiting = number;
+			continue;
+		}
 
-	switch (resolution) // Chceck the correct value dur to resolution
-	{
-		case DS18B20_Resolution_9bits:
-			result = temperature*(float)DS18B20_STEP_9BIT;
-		break;
-		case DS18B20_Resolution_10bits:
-			result = temperature*(float)DS18B20_STEP_10BIT;
-		 break;
-		case DS18B20_Resolution_11bits:
-			result = temperature*(float)DS18B20_STEP_11BIT;
-		break;
-		case DS18B20_Resolution_12bits:
-			result = temperature*(float)DS18B20_STEP_12BIT;
-		 break;
-		default: 
-			result = 0xFF;
+		if (!DS18B20_TimeToReady(bus, number))
+		{
+			bus->StaggerNext = number + 1;
+			return DS18B20_StaggerRead(bus, number);
+		}
 	}
-	
-	*destination = result;
-	
-	return 1; //temperature valid
+
+	if (waiting != DS18B20_NOT_FOUND &&
+			tick - bus->StaggerTick >= DS18B20_ConversionTime(DS18B20_KnownResolution(bus, waiting)) / bus->SensorCount)
+	{
+		bus->StaggerTick = tick;
+		DS18B20_StaggerStart(bus, waiting);
+	}
+
+	return 0;
 }
 
-uint8_t DS18B20_GetResolution(uint8_t number)
+//
+//	Parallel buses - one sensor string per pin
+//
+//	Returns:
+//	Buses that answered the reset
+//
+uint16_t DS18B20_MultiStartAll(OneWireMulti_t* multi)
 {
-	if( number >= TempSensorCount)
-		return 0;
+	uint16_t pins;
 
-	uint8_t conf;
-	
-	if (!DS18B20_Is((uint8_t*)&ds18b20[number].Address))
-		return 0;
-	
-	OneWire_Reset(&OneWire); // Reset the bus
-	OneWire_SelectWithPointer(&OneWire, (uint8_t*)&ds18b20[number].Address); // Select the sensor by ROM
-	OneWire_WriteByte(&OneWire, ONEWIRE_CMD_RSCRATCHPAD); // Read scratchpad command
-
-	OneWire_ReadByte(&OneWire);
-	OneWire_ReadByte(&OneWire);
-	OneWire_ReadByte(&OneWire);
-	OneWire_ReadByte(&OneWire);
-	
-	conf = OneWire_ReadByte(&OneWire); // Register 5 is the configuration register with resolution
-	conf &= 0x60; // Mask two resolution bits
-	conf >>= 5; // Shift to left
-	conf += 9; // Get the result in number of resolution bits
-	
-	return conf;
+	pins = OneWireMulti_Reset(multi, multi->GPIO_Pins); // Reset all buses
+	OneWireMulti_WriteByte(multi, pins, ONEWIRE_CMD_SKIPROM); // Skip ROM command
+	OneWireMulti_WriteByte(multi, pins, DS18B20_CMD_CONVERTTEMP); // Start conversion on all sensors of all buses
+
+	return pins;
 }
 
-uint8_t DS18B20_SetResolution(uint8_t number, DS18B20_Resolution_t resolution)
+//
+//	Read one sensor per bus - @ROM holds 8 bytes for every bus (ROM[bus * 8]),
+//	NULL for buses with a single sensor. Temperature of bus n goes to
+//	temperature[n].
+//
+//	Returns:
+//	Buses with valid data
+//
+uint16_t DS18B20_MultiRead(OneWireMulti_t* multi, uint16_t pins, const uint8_t* ROM, int16_t* temperature)
 {
-	if( number >= TempSensorCount)
-		return 0;
+	uint8_t data[ONEWIRE_MULTI_MAX_BUSES * DS18B20_DATA_LEN];
+	uint16_t valid = 0;
+	uint8_t i;
 
-	uint8_t th, tl, conf;
-	if (!DS18B20_Is((uint8_t*)&ds18b20[number].Address))
+	pins = OneWireMulti_Reset(multi, pins); // Buses without presence drop out
+	if (!pins)
 		return 0;
-	
-	OneWire_Reset(&OneWire); // Reset the bus
-	OneWire_SelectWithPointer(&OneWire, (uint8_t*)&ds18b20[number].Address); // Select the sensor by ROM
-	OneWire_WriteByte(&OneWire, ONEWIRE_CMD_RSCRATCHPAD); // Read scratchpad command
-	
-	OneWire_ReadByte(&OneWire);
-	OneWire_ReadByte(&OneWire);
-	
-	th = OneWire_ReadByte(&OneWire); 	// Writing to scratchpad begins from the temperature alarms bytes
-	tl = OneWire_ReadByte(&OneWire); 	// 	so i have to store them.
-	conf = OneWire_ReadByte(&OneWire);	// Config byte
-	
-	if (resolution == DS18B20_Resolution_9bits) // Bits setting
+
+	if (ROM)
 	{
-		conf &= ~(1 << DS18B20_RESOLUTION_R1);
-		conf &= ~(1 << DS18B20_RESOLUTION_R0);
+		OneWireMulti_WriteByte(multi, pins, ONEWIRE_CMD_MATCHROM); // Select one sensor on every bus
+		OneWireMulti_WriteBlock(multi, pins, ROM, 8);
 	}
-	else if (resolution == DS18B20_Resolution_10bits) 
+	else
+		OneWireMulti_WriteByte(multi, pins, ONEWIRE_CMD_SKIPROM);
+
+	OneWireMulti_WriteByte(multi, pins, ONEWIRE_CMD_RSCRATCHPAD); // Read scratchpad command
+	OneWireMulti_ReadBlock(multi, pins, data, DS18B20_DATA_LEN);
+
+	for (i = 0; i < ONEWIRE_MULTI_MAX_BUSES; i++)
 	{
-		conf &= ~(1 << DS18B20_RESOLUTION_R1);
-		conf |= 1 << DS18B20_RESOLUTION_R0;
+		if ((pins & (1U << i)) && DS18B20_Decode(&data[i * DS18B20_DATA_LEN], &temperature[i]))
+			valid |= 1U << i;
 	}
-	else if (resolution == DS18B20_Resolution_11bits)
+
+	return valid;
+}
+
+void DS18B20_GetROM(Ds18b20Bus_t* bus, uint8_t number, uint8_t* ROM)
+{
+	if( number >= bus->SensorCount)
+		number = bus->SensorCount;
+
+	uint8_t i;
+
+	for(i = 0; i < 8; i++)
+		ROM[i] = bus->Address[number][i];
+}
+
+void DS18B20_WriteROM(Ds18b20Bus_t* bus, uint8_t number, uint8_t* ROM)
+{
+	if( number >= bus->SensorCount)
+		return;
+
+	uint8_t i;
+
+	for(i = 0; i < 8; i++)
+		bus->Address[number][i] = ROM[i]; // Write ROM into sensor's table
+	bus->Status[number] &= ~DS18B20_STATUS_CONFIG; // Another sensor - read its configuration on the next change
+
+	DS18B20_IndexTable(bus); // ROM order changed
+}
+
+//
+//	Binary search over the ROM order
+//
+//	Returns:
+//	Sensor number, DS18B20_NOT_FOUND if the ROM is not in the table
+//
+uint8_t DS18B20_Find(Ds18b20Bus_t* bus, const uint8_t* ROM)
+{
+	uint8_t low = 0, high = bus->SensorCount, middle;
+	int compare;
+
+	while (low < high)
 	{
-		conf |= 1 << DS18B20_RESOLUTION_R1;
-		conf &= ~(1 << DS18B20_RESOLUTION_R0);
+		middle = (low + high) / 2;
+		compare = memcmp(ROM, bus->Address[bus->Sorted[middle]], 8);
+
+		if (!compare)
+			return bus->Sorted[middle];
+
+		if (compare < 0)
+			high = middle;
+		else
+			low = middle + 1;
 	}
-	else if (resolution == DS18B20_Resolution_12bits)
+
+	return DS18B20_NOT_FOUND;
+}
+
+//
+//	Presence check without a scratchpad read - a search pass along the
+//	sensor's ROM that ends at the first bit where it is missing
+//
+//	Returns:
+//	1 - Sensor answers on the bus
+//	0 - Sensor is gone, or no such number
+//
+uint8_t DS18B20_IsPresent(Ds18b20Bus_t* bus, uint8_t number)
+{
+	if (number >= bus->SensorCount)
+		return 0;
+
+	return OneWire_Verify(&bus->OneWire, bus->Address[number]);
+}
+
+//
+//	Hot-plug - the table is checked one search pass per call, so readings
+//	never wait for a whole re-enumeration. Every known sensor is verified
+//	with a search that follows its own ROM. The pass also shows every
+//	bit where another device branches off that path; a branch with no
+//	known sensor in it gets one targeted search on the next call. Only
+//	new subtrees are searched, unchanged ones cost the verify pass.
+//
+static uint8_t DS18B20_HotplugSearch(Ds18b20Bus_t* bus, const uint8_t* path)
+{
+	memcpy(bus->OneWire.ROM_NO, path, 8);
+	bus->OneWire.LastDiscrepancy = 64; // Follow the path on every discrepancy
+	bus->OneWire.LastFamilyDiscrepancy = 0;
+	bus->OneWire.LastDeviceFlag = 0;
+
+	return OneWire_Search(&bus->OneWire, ONEWIRE_CMD_SEARCHROM);
+}
+
+//
+//	Any known sensor with the same ROM bits below @bit and the other value at @bit
+//
+static uint8_t DS18B20_HotplugKnownBranch(Ds18b20Bus_t* bus, const uint8_t* ROM, uint8_t bit)
+{
+	uint8_t i, byte = bit >> 3, mask = 1 << (bit & 7);
+
+	for (i = 0; i < bus->SensorCount; i++)
 	{
-		conf |= 1 << DS18B20_RESOLUTION_R1;
-		conf |= 1 << DS18B20_RESOLUTION_R0;
+		if (!memcmp(bus->Address[i], ROM, byte) &&
+				!((bus->Address[i][byte] ^ ROM[byte]) & (mask - 1)) &&
+				((bus->Address[i][byte] ^ ROM[byte]) & mask))
+			return 1;
 	}
-	
-	OneWire_Reset(&OneWire); // Reset the bus
-	OneWire_SelectWithPointer(&OneWire, (uint8_t*)&ds18b20[number].Address); // Select the sensor by ROM
-	OneWire_WriteByte(&OneWire, ONEWIRE_CMD_WSCRATCHPAD); // Write scratchpad command
-	
-	OneWire_WriteByte(&OneWire, th); // Write 3 bytes to scratchpad
-	OneWire_WriteByte(&OneWire, tl);
-	OneWire_WriteByte(&OneWire, conf);
-	
-	OneWire_Reset(&OneWire); // Reset the bus
-	OneWire_SelectWithPointer(&OneWire, (uint8_t*)&ds18b20[number].Address); // Select the sensor by ROM
-	OneWire_WriteByte(&OneWire, ONEWIRE_CMD_CPYSCRATCHPAD); // Copy scratchpad to EEPROM
-	
-	return 1;
+
+	return 0;
 }
 
-uint8_t DS18B20_Is(uint8_t* ROM)
+//
+//	After a verify pass along sensor @number - first ROM bit from @from on
+//	where another device branches off into a subtree with no known sensor
+//
+//	Returns:
+//	Bit number + 1, 0 - every branch leads to a known sensor
+//
+uint8_t DS18B20_UnknownBranch(Ds18b20Bus_t* bus, uint8_t number, uint8_t from)
 {
-	if (*ROM == DS18B20_FAMILY_CODE) // Check family code
-		return 1;
+	uint8_t bit;
+
+	for (bit = from; bit < 64; bit++)
+	{
+		if ((bus->OneWire.Discrepancy[bit >> 3] & (1 << (bit & 7))) &&
+				!DS18B20_HotplugKnownBranch(bus, bus->Address[number], bit))
+			return bit + 1;
+	}
+
 	return 0;
 }
 
-uint8_t DS18B20_AllDone(void)
+static uint8_t DS18B20_HotplugEvent(Ds18b20Bus_t* bus, uint8_t number, uint8_t event)
 {
-	return OneWire_ReadBit(&OneWire); // Bus is down - busy
+	bus->HotplugChanged = 1;
+	bus->SensorsOnly = 0; // Proved again by a round over the new table
+
+	if (bus->HotplugCallback)
+		bus->HotplugCallback(bus, number, event);
+
+	return event;
 }
 
-void DS18B20_ReadAll(void)
+static uint8_t DS18B20_HotplugAdd(Ds18b20Bus_t* bus, const uint8_t* ROM)
 {
-	uint8_t i;
+	uint8_t number = bus->SensorCount;
+
+	if (number >= bus->Capacity)
+		return DS18B20_HOTPLUG_NONE;
+
+	memcpy(bus->Address[number], ROM, 8);
+	bus->Temperature[number] = 0;
+	bus->Status[number] = 0;
+	DS18B20_SetKnownResolution(bus, number, DS18B20_Resolution_12bits); // Power-up default until it is set
+	bus->SensorCount++;
+	DS18B20_IndexTable(bus);
+	DS18B20_SetParasite(bus, number, DS18B20_IsParasite(bus, number)); // Before the EEPROM copy
+
+	DS18B20_SetResolution(bus, number, bus->Resolution);
+
+	return DS18B20_HotplugEvent(bus, number, DS18B20_HOTPLUG_ADDED);
+}
+
+static uint8_t DS18B20_HotplugRemove(Ds18b20Bus_t* bus, uint8_t number)
+{
+	uint8_t rest = bus->SensorCount - number - 1;
+
+	DS18B20_HotplugEvent(bus, number, DS18B20_HOTPLUG_REMOVED); // Entry still valid in the callback
+	DS18B20_SetParasite(bus, number, 0);
+
+	memmove(bus->Address[number], bus->Address[number + 1], rest * 8);
+	memmove(&bus->Temperature[number], &bus->Temperature[number + 1], rest * sizeof(bus->Temperature[0]));
+	memmove(&bus->Status[number], &bus->Status[number + 1], rest);
+	memmove(bus->Config[number], bus->Config[number + 1], rest * 3);
+	memmove(&bus->ConversionStart[number], &bus->ConversionStart[number + 1], rest * sizeof(bus->ConversionStart[0]));
+	memmove(&bus->SampleTick[number], &bus->SampleTick[number + 1], rest * sizeof(bus->SampleTick[0]));
+	bus->SensorCount--;
+	DS18B20_IndexTable(bus);
+
+	return DS18B20_HOTPLUG_REMOVED;
+}
+
+//
+//	One hot-plug step - call from the main loop when the bus is free
+//
+//	Returns:
+//	DS18B20_HOTPLUG_* event of this step
+//
+uint8_t DS18B20_Hotplug(Ds18b20Bus_t* bus)
+{
+	uint8_t number, bit;
+
+	if (DS18B20_AsyncBusy(bus) || OneWire_PullupActive(&bus->OneWire))
+		return DS18B20_HOTPLUG_NONE; // Bus taken by queued transactions or a parasite conversion
 
-	if (DS18B20_AllDone())
+	if (bus->HotplugBranch) // Branch seen on the last pass - one targeted search into it
 	{
-		for(i = 0; i < TempSensorCount; i++) // All detected sensors loop
-		{
-			ds18b20[i].ValidDataFlag = 0;
+		bus->HotplugBranch = 0;
+		if (DS18B20_HotplugSearch(bus, bus->HotplugPath) && DS18B20_Is(bus->OneWire.ROM_NO) &&
+				DS18B20_Find(bus, bus->OneWire.ROM_NO) == DS18B20_NOT_FOUND)
+			return DS18B20_HotplugAdd(bus, bus->OneWire.ROM_NO);
+		return DS18B20_HOTPLUG_NONE;
+	}
 
-			if (DS18B20_Is((uint8_t*)&ds18b20[i].Address))
-			{
-				ds18b20[i].ValidDataFlag = DS18B20_Read(i, &ds18b20[i].Temperature); // Read single sensor
-			}
-		}
+	if (bus->HotplugCursor >= bus->SensorCount) // Round done
+	{
+		bus->HotplugCursor = 0;
+#ifdef _DS18B20_ROM_STORE
+		if (bus->HotplugChanged)
+			DS18B20_StoreSave(bus, bus->Resolution);
+#endif
+		bus->SensorsOnly = bus->SensorCount && !bus->HotplugChanged && !bus->HotplugUnknown; // Every sensor verified, no branch outside the table
+		bus->HotplugChanged = 0;
+		bus->HotplugUnknown = 0;
+	}
+
+	if (!bus->SensorCount) // Nothing known - look for the first sensor
+	{
+		OneWire_TargetSetup(&bus->OneWire, DS18B20_FAMILY_CODE);
+		if (OneWire_Search(&bus->OneWire, ONEWIRE_CMD_SEARCHROM) && DS18B20_Is(bus->OneWire.ROM_NO))
+			return DS18B20_HotplugAdd(bus, bus->OneWire.ROM_NO);
+		return DS18B20_HOTPLUG_NONE;
+	}
+
+	number = bus->HotplugCursor;
+
+	if (!OneWire_Verify(&bus->OneWire, bus->Address[number])) // Cursor stays, the next call asks the same sensor
+	{
+		bus->HotplugUnknown = 1;
+		if (++bus->HotplugMisses < _DS18B20_HOTPLUG_MISSES)
+			return DS18B20_HOTPLUG_NONE;
+
+		bus->HotplugMisses = 0;
+		return DS18B20_HotplugRemove(bus, number); // Next sensor moved to this number
+	}
+
+	bus->HotplugMisses = 0;
+
+	bus->SingleDevice = bus->SensorCount == 1 && !DS18B20_Branched(bus); // Same pass tells if another device came
+	if (DS18B20_UnknownBranch(bus, number, 0)) // Other family, or a sensor the table has no room for
+	{
+		bus->SensorsOnly = 0;
+		bus->HotplugUnknown = 1;
+	}
+
+	if (bus->SensorCount < bus->Capacity && (bit = DS18B20_UnknownBranch(bus, number, 8))) // Family code bits lead to other families
+	{
+		bus->HotplugBranch = bit--;
+		memset(bus->HotplugPath, 0, 8); // Same path below the bit, the other way at it
+		memcpy(bus->HotplugPath, bus->Address[number], bit >> 3);
+		bus->HotplugPath[bit >> 3] = (bus->Address[number][bit >> 3] & ((1 << (bit & 7)) - 1)) |
+				(~bus->Address[number][bit >> 3] & (1 << (bit & 7)));
+		return DS18B20_HOTPLUG_NONE; // Same sensor is verified again after the search
 	}
+
+	bus->HotplugCursor++;
+
+	return DS18B20_HOTPLUG_NONE;
 }
 
-void DS18B20_GetROM(uint8_t number, uint8_t* ROM)
+uint8_t DS18B20_Quantity(Ds18b20Bus_t* bus)
 {
-	if( number >= TempSensorCount)
-		number = TempSensorCount;
+	return bus->SensorCount;
+}
 
-	uint8_t i;
+uint8_t DS18B20_GetTemperature(Ds18b20Bus_t* bus, uint8_t number, int16_t* destination)
+{
+	if(number >= bus->SensorCount || !(bus->Status[number] & DS18B20_STATUS_VALID))
+		return 0;
+
+	*destination = bus->Temperature[number];
+	return 1;
 
-	for(i = 0; i < 8; i++)
-		ROM[i] = ds18b20[number].Address[i];
 }
 
-void DS18B20_WriteROM(uint8_t number, uint8_t* ROM)
+uint8_t DS18B20_GetTemperatureMilli(Ds18b20Bus_t* bus, uint8_t number, int32_t* destination)
 {
-	if( number >= TempSensorCount)
-		return;
+	if(number >= bus->SensorCount || !(bus->Status[number] & DS18B20_STATUS_VALID))
+		return 0;
 
-	uint8_t i;
+	*destination = DS18B20_ToMilliCelsius(bus->Temperature[number]);
+	return 1;
+}
 
-	for(i = 0; i < 8; i++)
-		ds18b20[number].Address[i] = ROM[i]; // Write ROM into sensor's structure
+//
+//	Fixed-point conversions - raw value is 1/16 degC at every resolution
+//
+int32_t DS18B20_ToMilliCelsius(int16_t raw)
+{
+	return ((int32_t)raw * 125) / 2; // 62.5 mdegC per LSB
 }
 
-uint8_t DS18B20_Quantity(void)
+int16_t DS18B20_ToWholeCelsius(int16_t raw)
 {
-	return TempSensorCount;
+	return raw >> 4; // Arithmetic shift - -0.5 degC gives -1
 }
 
-uint8_t DS18B20_GetTemperature(uint8_t number, float* destination)
+#ifdef _DS18B20_USE_FLOAT
+uint8_t DS18B20_GetTemperatureFloat(Ds18b20Bus_t* bus, uint8_t number, float* destination)
 {
-	if(!ds18b20[number].ValidDataFlag)
+	if(number >= bus->SensorCount || !(bus->Status[number] & DS18B20_STATUS_VALID))
 		return 0;
 
-	*destination = ds18b20[number].Temperature;
+	*destination = bus->Temperature[number] * (float)DS18B20_STEP_12BIT; // Raw value is always in 12 bit steps
 	return 1;
+}
+#endif
+
+void DS18B20_Init(Ds18b20Bus_t* bus, GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, DS18B20_Resolution_t resolution)
+{
+	OneWire_Init(&bus->OneWire, GPIOx, GPIO_Pin); // Init OneWire bus
+	OneWireAsync_Init(&_DS18B20_TIMER); // Non-blocking transactions on the same timer
 
+	DS18B20_InitBus(bus, resolution);
 }
 
-void DS18B20_Init(DS18B20_Resolution_t resolution)
+void DS18B20_InitBus(Ds18b20Bus_t* bus, DS18B20_Resolution_t resolution)
 {
-	uint8_t next = 0, i = 0, j;
-	OneWire_Init(&OneWire, DS18B20_GPIO_Port, DS18B20_Pin); // Init OneWire bus
+	uint8_t next = 0, i = 0, j, foreign = 0;
 
-	next = OneWire_First(&OneWire); // Search first OneWire device
-	while(next)
+	bus->SensorCount = 0;
+	bus->SingleDevice = 0;
+	bus->SensorsOnly = 0;
+	bus->PollState = DS18B20_POLL_IDLE;
+	bus->StaggerNext = 0;
+	bus->StartTransaction.Status = ONEWIRE_ASYNC_IDLE;
+	bus->ReadTransaction.Status = ONEWIRE_ASYNC_IDLE;
+	bus->ChangeCycle = 0;
+	bus->Resolution = resolution;
+	if (bus->AdaptiveMin >= resolution) // Adaptive mode needs a slower resolution to go back to
+		bus->AdaptiveMin = 0;
+	bus->HotplugCursor = 0;
+	bus->HotplugMisses = 0;
+	bus->HotplugBranch = 0;
+	bus->HotplugChanged = 0;
+	bus->HotplugUnknown = 0;
+	memset(bus->Status, 0, bus->Capacity);
+
+	OneWire_Reset(&bus->OneWire); // Reset the bus
+	DS18B20_SkipRom(bus, ONEWIRE_CMD_RECEEPROM); // Scratchpads back to EEPROM - a warm restart may leave bands in them
+
+#ifdef _DS18B20_ROM_STORE
+	if (DS18B20_StoreLoad(bus, resolution)) // Same sensors as last time and no new one - no search, no EEPROM writes
 	{
-		TempSensorCount++;
-		OneWire_GetFullROM(&OneWire, (uint8_t*)&ds18b20[i++].Address); // Get the ROM of next sensor
-		next = OneWire_Next(&OneWire);
-		if(TempSensorCount >= _DS18B20_MAX_SENSORS) // More sensors than set maximum is not allowed
-			break;
+		DS18B20_IndexTable(bus);
+		DS18B20_CheckSingle(bus);
+		DS18B20_DetectPower(bus);
+		DS18B20_StartAll(bus);
+		return;
 	}
+#endif
 
-	for(j = 0; j < i; j++)
+	OneWire_TargetSetup(&bus->OneWire, DS18B20_FAMILY_CODE); // Only the DS18B20 branch of the ROM tree
+	next = OneWire_Search(&bus->OneWire, ONEWIRE_CMD_SEARCHROM);
+	while(next && DS18B20_Is(bus->OneWire.ROM_NO) && bus->SensorCount < bus->Capacity) // Other family - no DS18B20 left
 	{
-		DS18B20_SetResolution(j, resolution); // Set the initial resolution to sensor
-
-		DS18B20_StartAll(); // Start conversion on all sensors
+		bus->SensorCount++;
+		DS18B20_SetKnownResolution(bus, i, DS18B20_Resolution_12bits); // Power-up default until it is set
+		OneWire_GetFullROM(&bus->OneWire, bus->Address[i++]); // Get the ROM of next sensor
+		foreign |= bus->OneWire.Discrepancy[0]; // Every pass takes the 0x28 family code, other families branch off in it
+		if (bus->OneWire.LastDiscrepancy <= 8) // Next branch is in the family code - no DS18B20 left
+		{
+			bus->SensorsOnly = bus->OneWire.LastDeviceFlag && !foreign; // No branch left and none in the family code
+			break;
+		}
+		next = OneWire_Next(&bus->OneWire);
 	}
-}
 
+	DS18B20_IndexTable(bus);
+	DS18B20_CheckSingle(bus); // Skip ROM from here on when nothing else is on the bus
+	DS18B20_DetectPower(bus); // Before the EEPROM copies
+
+	for(j = 0; j < i; j++)
+		DS18B20_ReadConfig(bus, j); // Recalled EEPROM settings
+
+	DS18B20_SetResolutionAll(bus, resolution); // Only sensors with another resolution are written
+	DS18B20_StartAll(bus); // Start conversion on all sensors
 
+#ifdef _DS18B20_ROM_STORE
+	DS18B20_StoreSave(bus, resolution); // Next boot checks these sensors only
+#endif
+}
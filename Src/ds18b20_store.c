@@ -0,0 +1,249 @@
+/*
+ * ds18b20_store.c
+ *
+ *	The MIT License.
+ *
+ */
+#include <stddef.h>
+#include <string.h>
+#include "ds18b20_store.h"
+
+#ifdef _DS18B20_ROM_STORE
+
+#define DS18B20_STORE_MAGIC		0x38314453 // "DS18"
+#define DS18B20_STORE_ERASED	0xFFFFFFFF
+
+//
+//	Flash record header - Count ROMs of 8 bytes follow it. Records are
+//	appended one after another, the last valid one of a bus counts.
+//
+typedef struct
+{
+	uint32_t	Magic;
+	uint32_t	Key;				// Bus the table belongs to
+	uint8_t		Count;				// Sensors found
+	uint8_t		Resolution;			// Set on every sensor
+	uint16_t	Crc;				// CRC16 of the header above and the ROMs
+} Ds18b20StoreRecord_t;
+
+#define DS18B20_STORE_HEADER_CRC_LEN	offsetof(Ds18b20StoreRecord_t, Crc)
+
+static uint32_t DS18B20_StoreRecordSize(uint8_t count)
+{
+	return sizeof(Ds18b20StoreRecord_t) + count * 8; // Stays word aligned
+}
+
+static const uint8_t* DS18B20_StoreRoms(const Ds18b20StoreRecord_t* record)
+{
+	return (const uint8_t*)(record + 1);
+}
+
+//
+//	1-Wire CRC16 (x^16 + x^15 + x^2 + 1), the record is longer than CRC8 covers well
+//
+static uint16_t DS18B20_StoreCrc(uint16_t crc, const uint8_t* data, uint16_t len)
+{
+	uint8_t i;
+
+	while (len--)
+	{
+		crc ^= *data++;
+		for (i = 8; i; i--)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+
+	return crc;
+}
+
+static uint16_t DS18B20_StoreRecordCrc(const Ds18b20StoreRecord_t* record, const uint8_t* ROMs)
+{
+	uint16_t crc;
+
+	crc = DS18B20_StoreCrc(0, (const uint8_t*)record, DS18B20_STORE_HEADER_CRC_LEN);
+	return DS18B20_StoreCrc(crc, ROMs, record->Count * 8);
+}
+
+//
+//	Bus identification - pin for the GPIO backend, transport data otherwise
+//
+static uint32_t DS18B20_StoreKey(Ds18b20Bus_t* bus)
+{
+	if (bus->OneWire.GPIOx)
+		return (uint32_t)(uintptr_t)bus->OneWire.GPIOx | bus->OneWire.GPIO_Pin;
+
+	return (uint32_t)(uintptr_t)bus->OneWire.Backend;
+}
+
+//
+//	Walk the records of the sector
+//
+//	Returns:
+//	Last valid record of @key or NULL. @end gets the first erased word,
+//	or the sector end when the log is full or broken.
+//
+static const Ds18b20StoreRecord_t* DS18B20_StoreFind(uint32_t key, uint32_t* end)
+{
+	const Ds18b20StoreRecord_t* found = NULL;
+	const Ds18b20StoreRecord_t* record;
+	uint32_t address = _DS18B20_ROM_STORE_ADDRESS;
+	uint32_t limit = _DS18B20_ROM_STORE_ADDRESS + _DS18B20_ROM_STORE_SIZE;
+
+	while (address + sizeof(Ds18b20StoreRecord_t) <= limit)
+	{
+		record = (const Ds18b20StoreRecord_t*)(uintptr_t)address;
+
+		if (record->Magic == DS18B20_STORE_ERASED) // Free space starts here
+			break;
+
+		if (record->Magic != DS18B20_STORE_MAGIC || address + DS18B20_StoreRecordSize(record->Count) > limit)
+		{
+			address = limit; // Unknown content - nothing can be appended
+			break;
+		}
+
+		if (record->Key == key && record->Crc == DS18B20_StoreRecordCrc(record, DS18B20_StoreRoms(record)))
+			found = record; // Newer records of the bus come later
+
+		address += DS18B20_StoreRecordSize(record->Count); // Broken record with a good header is skipped
+	}
+
+	if (end)
+		*end = address;
+
+	return found;
+}
+
+//
+//	Targeted check of one stored sensor - a verify pass along its ROM,
+//	which leaves it selected like Match ROM, and the scratchpad up to
+//	the configuration byte. The pass also shows a DS18B20 that branches
+//	off the ROM where no stored sensor is. TH, TL and the configuration
+//	go to the cache.
+//
+static uint8_t DS18B20_StoreCheck(Ds18b20Bus_t* bus, uint8_t number, DS18B20_Resolution_t resolution)
+{
+	uint8_t data[DS18B20_DATA_LEN];
+
+	if (!OneWire_Verify(&bus->OneWire, bus->Address[number])) // Sensor gone, or no presence pulse at all
+		return 0;
+
+	if (bus->SensorCount < bus->Capacity && DS18B20_UnknownBranch(bus, number, 8)) // New sensor - search the bus
+		return 0;
+
+	if (DS18B20_UnknownBranch(bus, number, 0)) // Other family, or a sensor the full table has no room for
+		bus->SensorsOnly = 0;
+
+	OneWire_WriteByte(&bus->OneWire, ONEWIRE_CMD_RSCRATCHPAD);
+	OneWire_ReadBlock(&bus->OneWire, data, DS18B20_DATA_LEN);
+
+#ifdef _DS18B20_USE_CRC
+	if (OneWire_CRC8(data, 8) != data[8])
+		return 0;
+#endif
+
+	if ((data[4] & 0x9F) != 0x1F) // Reserved bits of the configuration register
+		return 0;
+
+	memcpy(bus->Config[number], &data[2], 3);
+
+	return (((data[4] & 0x60) >> 5) + 9) == (int)resolution;
+}
+
+//
+//	Fill the sensor table from flash
+//
+//	Returns:
+//	1 - Every stored sensor answered with the requested resolution
+//	0 - No record or the bus changed, search it
+//
+uint8_t DS18B20_StoreLoad(Ds18b20Bus_t* bus, DS18B20_Resolution_t resolution)
+{
+	const Ds18b20StoreRecord_t* record = DS18B20_StoreFind(DS18B20_StoreKey(bus), NULL);
+	uint8_t i;
+
+	if (!record || !record->Count || record->Count > bus->Capacity || record->Resolution != resolution)
+		return 0;
+
+	memcpy(bus->Address, DS18B20_StoreRoms(record), record->Count * 8); // Branches are told from the whole table
+	bus->SensorCount = record->Count;
+	bus->SensorsOnly = 1; // Until a verify pass shows another device
+
+	for (i = 0; i < record->Count; i++)
+	{
+		if (!DS18B20_StoreCheck(bus, i, resolution))
+		{
+			bus->SensorCount = 0;
+			bus->SensorsOnly = 0;
+			return 0;
+		}
+	}
+
+	OneWire_Reset(&bus->OneWire); // End the last scratchpad read
+
+	for (i = 0; i < record->Count; i++)
+		bus->Status[i] = (((resolution - 9) << DS18B20_RESOLUTION_R0) & DS18B20_STATUS_RESOLUTION) | DS18B20_STATUS_CONFIG;
+
+	return 1;
+}
+
+//
+//	Store the sensor table of @bus - a record is appended only when it
+//	differs from the stored one, the sector is erased when it is full
+//
+//	Returns:
+//	1 - Record is in flash
+//	0 - Flash erase or programming failed
+//
+uint8_t DS18B20_StoreSave(Ds18b20Bus_t* bus, DS18B20_Resolution_t resolution)
+{
+	FLASH_EraseInitTypeDef erase;
+	Ds18b20StoreRecord_t record;
+	const Ds18b20StoreRecord_t* old;
+	uint32_t error, address, size, word;
+	uint16_t i;
+	HAL_StatusTypeDef status = HAL_OK;
+
+	memset(&record, 0, sizeof(record));
+	record.Magic = DS18B20_STORE_MAGIC;
+	record.Key = DS18B20_StoreKey(bus);
+	record.Count = bus->SensorCount;
+	record.Resolution = resolution;
+	record.Crc = DS18B20_StoreRecordCrc(&record, (const uint8_t*)bus->Address);
+
+	old = DS18B20_StoreFind(record.Key, &address);
+	if (old && !memcmp(old, &record, sizeof(record)) && !memcmp(DS18B20_StoreRoms(old), bus->Address, record.Count * 8))
+		return 1; // Nothing changed - no flash write
+
+	size = DS18B20_StoreRecordSize(record.Count);
+
+	HAL_FLASH_Unlock();
+
+	if (address + size > _DS18B20_ROM_STORE_ADDRESS + _DS18B20_ROM_STORE_SIZE) // Full - start over, other buses search once more
+	{
+		erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+		erase.Sector = _DS18B20_ROM_STORE_SECTOR;
+		erase.NbSectors = 1;
+		erase.VoltageRange = FLASH_VOLTAGE_RANGE_3; // 2.7 - 3.6 V, 32 bit parallelism
+
+		status = HAL_FLASHEx_Erase(&erase, &error);
+		address = _DS18B20_ROM_STORE_ADDRESS;
+	}
+
+	for (i = 0; status == HAL_OK && i < sizeof(record); i += 4, address += 4) // Header first - a cut write leaves a record with a bad CRC
+	{
+		memcpy(&word, (const uint8_t*)&record + i, 4);
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, word);
+	}
+
+	for (i = 0; status == HAL_OK && i < record.Count * 8; i += 4, address += 4) // ROM table may be unaligned
+	{
+		memcpy(&word, (const uint8_t*)bus->Address + i, 4);
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address, word);
+	}
+
+	HAL_FLASH_Lock();
+
+	return status == HAL_OK;
+}
+
+#endif
@@ -46,13 +46,15 @@
 #include "onewire.h"
 #include "ds18b20.h"
 #include "string.h"
+#include "stdlib.h"
 /* USER CODE END Includes */
 
 /* Private variables ---------------------------------------------------------*/
 
 /* USER CODE BEGIN PV */
 /* Private variables ---------------------------------------------------------*/
-float temperature;
+DS18B20_BUS_DEFINE(Ds18b20Bus, 4); // Up to 4 sensors on the bus
+int32_t temperature; // milli degC
 char message[64];
 /* USER CODE END PV */
 
@@ -97,7 +99,7 @@ int main(void)
   MX_USART2_UART_Init();
 
   /* USER CODE BEGIN 2 */
-  DS18B20_Init(DS18B20_Resolution_12bits);
+  DS18B20_Init(&Ds18b20Bus, DS18B20_GPIO_Port, DS18B20_Pin, DS18B20_Resolution_12bits);
   HAL_GPIO_WritePin(TEST_GPIO_Port, TEST_Pin, 0);
   /* USER CODE END 2 */
 
@@ -109,25 +111,26 @@ int main(void)
 
   /* USER CODE BEGIN 3 */
 
-	  DS18B20_ReadAll();
 	  HAL_GPIO_WritePin(TEST_GPIO_Port, TEST_Pin, 1);
-      DS18B20_StartAll();
-      HAL_GPIO_WritePin(TEST_GPIO_Port, TEST_Pin, 0);
+	  if(DS18B20_Poll(&Ds18b20Bus)) // Results are read as soon as the conversion is done
+	  {
 		uint8_t ROM_tmp[8];
 		uint8_t i;
-	for(i = 0; i < DS18B20_Quantity(); i++)
+	for(i = 0; i < DS18B20_Quantity(&Ds18b20Bus); i++)
 		{
-			if(DS18B20_GetTemperature(i, &temperature))
+			if(DS18B20_GetTemperatureMilli(&Ds18b20Bus, i, &temperature))
 			{
-				DS18B20_GetROM(i, ROM_tmp);
+				DS18B20_GetROM(&Ds18b20Bus, i, ROM_tmp);
 				memset(message, 0, sizeof(message));
-				sprintf(message, "%d. ROM: %X%X%X%X%X%X%X%X Temp: %f\n\r",i, ROM_tmp[0], ROM_tmp[1], ROM_tmp[2], ROM_tmp[3], ROM_tmp[4], ROM_tmp[5], ROM_tmp[6], ROM_tmp[7], temperature);
+				sprintf(message, "%d. ROM: %X%X%X%X%X%X%X%X Temp: %s%ld.%03ld\n\r",i, ROM_tmp[0], ROM_tmp[1], ROM_tmp[2], ROM_tmp[3], ROM_tmp[4], ROM_tmp[5], ROM_tmp[6], ROM_tmp[7],
+						(temperature < 0) ? "-" : "", (long)(labs(temperature) / 1000), (long)(labs(temperature) % 1000)); // No float printf needed
 				HAL_UART_Transmit(&huart2, (uint8_t*)message, sizeof(message), 100);
 			}
 		}
 		HAL_UART_Transmit(&huart2, (uint8_t*)"\n\r", sizeof("\n\r"), 100);
-		HAL_Delay(1000);
 		HAL_GPIO_TogglePin(LED_GPIO_Port, LED_Pin);
+	  }
+	  HAL_GPIO_WritePin(TEST_GPIO_Port, TEST_Pin, 0);
   }
   /* USER CODE END 3 */
 
@@ -8,17 +8,50 @@
  *      mateusz@msalamon.pl
  *
  */
+#include <string.h>
 #include "tim.h"
 #include "onewire.h"
 #include "ds18b20.h"
 
 //
-//	Delay function for constant 1-Wire timings
+//	Timebase - DWT cycle counter. It runs free and nobody writes it, so
+//	any number of buses and interrupts measure on it at once. Waits are
+//	deadlines, time spent before the wait is part of it.
 //
-void OneWire_Delay(uint16_t us)
+static uint32_t OneWire_CyclesPerUs;
+
+void OneWire_TimebaseInit(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; // DWT on
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk; // Counter keeps its value - other users stay in step
+
+	OneWire_CyclesPerUs = SystemCoreClock / 1000000;
+}
+
+uint32_t OneWire_Time(void)
+{
+	return DWT->CYCCNT;
+}
+
+uint32_t OneWire_Cycles(uint16_t us)
+{
+	return us * OneWire_CyclesPerUs;
+}
+
+void OneWire_WaitUntil(uint32_t deadline)
+{
+	while ((int32_t)(deadline - DWT->CYCCNT) > 0);
+}
+
+//
+//	End of the recovery time of the last bit slot. A deadline longer
+//	ago than the counter half range would look ahead - only the near
+//	ones are waited for.
+//
+void OneWire_WaitIdle(OneWire_t *onewire)
 {
-	_DS18B20_TIMER.Instance->CNT = 0;
-	while(_DS18B20_TIMER.Instance->CNT <= us);
+	if (onewire->SlotEnd - OneWire_Time() <= OneWire_Cycles(ONEWIRE_RECOVERY_MAX))
+		OneWire_WaitUntil(onewire->SlotEnd);
 }
 
 //
@@ -58,97 +91,315 @@ void OneWire_OutputHigh(OneWire_t *onewire)
 }
 
 //
-//	1-Wire bus reset signal
+//	Slot primitives - pull the line low, release it, sample it
+//
+static inline void OneWire_BusLow(OneWire_t *onewire)
+{
+#ifdef _ONEWIRE_OPEN_DRAIN
+	onewire->GPIOx->BSRR = onewire->GPIO_Pin<<16; // Pin is already an open-drain output
+#else
+	OneWire_OutputLow(onewire);
+	OneWire_BusOutputDirection(onewire);
+#endif
+}
+
+static inline void OneWire_BusRelease(OneWire_t *onewire)
+{
+#ifdef _ONEWIRE_OPEN_DRAIN
+	onewire->GPIOx->BSRR = onewire->GPIO_Pin; // Open-drain high - line goes up by pullup
+#else
+	OneWire_BusInputDirection(onewire);
+#endif
+}
+
+static inline uint8_t OneWire_BusRead(OneWire_t *onewire)
+{
+	return (onewire->GPIOx->IDR & onewire->GPIO_Pin) ? 1 : 0; // Input buffer works in open-drain mode too
+}
+
+//
+//	GPIO backend - bus reset signal
+//
+//	Every slot is timed from its falling edge. It ends with the line
+//	released and SlotEnd set, the next slot waits for the rest of the
+//	recovery time - the code between slots runs in it.
 //
 //	Returns:
 //	0 - Reset ok
 //	1 - Error
 //
-uint8_t OneWire_Reset(OneWire_t* onewire)
+static uint8_t OneWire_GpioReset(OneWire_t* onewire)
 {
+	uint32_t start;
 	uint8_t i;
-	
-	OneWire_OutputLow(onewire);  // Write bus output low
-	OneWire_BusOutputDirection(onewire);
-	OneWire_Delay(480); // Wait 480 us for reset
 
-	OneWire_BusInputDirection(onewire); // Release the bus by switching to input
-	OneWire_Delay(70);
-	
-	i = HAL_GPIO_ReadPin(onewire->GPIOx, onewire->GPIO_Pin); // Check if bus is low
-															 // if it's high - no device is presence on the bus
-	OneWire_Delay(410);
+	OneWire_WaitIdle(onewire);
+	OneWire_BusLow(onewire);  // Write bus output low
+	start = OneWire_Time();
+	OneWire_WaitUntil(start + OneWire_Cycles(480)); // 480 us reset
+
+	OneWire_BusRelease(onewire); // Release the bus
+	OneWire_WaitUntil(start + OneWire_Cycles(480 + 70));
+
+	i = OneWire_BusRead(onewire); // Check if bus is low
+								  // if it's high - no device is presence on the bus
+	onewire->SlotEnd = start + OneWire_Cycles(480 + 70 + 410);
+	OneWire_WaitUntil(onewire->SlotEnd); // Whole presence time - other engines may take the bus after it
 
 	return i;
 }
 
 //
-//	Writing/Reading operations
+//	GPIO backend - writing/reading operations
 //
-void OneWire_WriteBit(OneWire_t* onewire, uint8_t bit)
+static void OneWire_GpioWriteBit(OneWire_t* onewire, uint8_t bit)
 {
-	if (bit) // Send '1',
-	{
-		OneWire_OutputLow(onewire);	// Set the bus low
-		OneWire_BusOutputDirection(onewire);
-		OneWire_Delay(6);
-		
-		OneWire_BusInputDirection(onewire); // Release bus - bit high by pullup
-		OneWire_Delay(64);
-	} 
-	else // Send '0'
-	{
-		OneWire_OutputLow(onewire); // Set the bus low
-		OneWire_BusOutputDirection(onewire);
-		OneWire_Delay(60);
-		
-		OneWire_BusInputDirection(onewire); // Release bus - bit high by pullup
-		OneWire_Delay(10);
-	}
+	uint32_t start;
+
+	OneWire_WaitIdle(onewire);
+	OneWire_BusLow(onewire); // Set the bus low
+	start = OneWire_Time();
+
+	OneWire_WaitUntil(start + OneWire_Cycles(bit ? 6 : 60)); // '1' - short pulse, '0' - whole slot
+	OneWire_BusRelease(onewire); // Release bus - bit high by pullup
+
+	onewire->SlotEnd = start + OneWire_Cycles(70);
 }
 
-uint8_t OneWire_ReadBit(OneWire_t* onewire)
+static uint8_t OneWire_GpioReadBit(OneWire_t* onewire)
 {
+	uint32_t start;
 	uint8_t bit = 0; // Default read bit state is low
-	
-	OneWire_OutputLow(onewire); // Set low to initiate reading
-	OneWire_BusOutputDirection(onewire);
-	OneWire_Delay(2);
-	
-	OneWire_BusInputDirection(onewire); // Release bus for Slave response
-	OneWire_Delay(10);
-	
-	if (HAL_GPIO_ReadPin(onewire->GPIOx, onewire->GPIO_Pin)) // Read the bus state
+
+	OneWire_WaitIdle(onewire);
+	OneWire_BusLow(onewire); // Set low to initiate reading
+	start = OneWire_Time();
+	OneWire_WaitUntil(start + OneWire_Cycles(2));
+
+	OneWire_BusRelease(onewire); // Release bus for Slave response
+	OneWire_WaitUntil(start + OneWire_Cycles(12));
+
+	if (OneWire_BusRead(onewire)) // Read the bus state
 		bit = 1;
-	
-	OneWire_Delay(50); // Wait for end of read cycle
+
+	onewire->SlotEnd = start + OneWire_Cycles(62); // End of read cycle
 
 	return bit;
 }
 
-void OneWire_WriteByte(OneWire_t* onewire, uint8_t byte)
+static void OneWire_GpioWriteBlock(OneWire_t* onewire, const uint8_t* data, uint16_t len)
 {
-	uint8_t i = 8;
+	uint8_t i, byte;
 
-	do
+	while (len--)
 	{
-		OneWire_WriteBit(onewire, byte & 1); // LSB first
-		byte >>= 1;
-	} while(--i);
+		byte = *data++;
+		i = 8;
+		do
+		{
+			OneWire_GpioWriteBit(onewire, byte & 1); // LSB first
+			byte >>= 1;
+		} while(--i);
+	}
+}
+
+static void OneWire_GpioReadBlock(OneWire_t* onewire, uint8_t* data, uint16_t len)
+{
+	uint8_t i, byte;
+
+	while (len--)
+	{
+		i = 8;
+		byte = 0;
+		do{
+			byte >>= 1;
+			byte |= (OneWire_GpioReadBit(onewire) << 7); // LSB first
+		} while(--i);
+		*data++ = byte;
+	}
+}
+
+//
+//	GPIO backend - strong pull-up, the bus pin goes push-pull high
+//
+static void OneWire_GpioStrongPullup(OneWire_t* onewire, uint8_t on)
+{
+	OneWire_OutputHigh(onewire);
+#ifdef _ONEWIRE_OPEN_DRAIN
+	if (on)
+		onewire->GPIOx->OTYPER &= ~onewire->GPIO_Pin; // Push-pull - the pin itself drives the line high
+	else
+		onewire->GPIOx->OTYPER |= onewire->GPIO_Pin; // Back to open-drain
+#else
+	if (on)
+	{
+		GPIO_InitTypeDef	GPIO_InitStruct;
+		GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP; // Push-pull high
+		GPIO_InitStruct.Pull = GPIO_NOPULL;
+		GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_MEDIUM;
+		GPIO_InitStruct.Pin = onewire->GPIO_Pin;
+		HAL_GPIO_Init(onewire->GPIOx, &GPIO_InitStruct);
+	}
+	else
+		OneWire_BusInputDirection(onewire); // Released - the resistor pulls up
+#endif
+}
+
+static const OneWire_Ops_t OneWire_GpioOps = {
+	.Reset = OneWire_GpioReset,
+	.WriteBit = OneWire_GpioWriteBit,
+	.ReadBit = OneWire_GpioReadBit,
+	.WriteBlock = OneWire_GpioWriteBlock,
+	.ReadBlock = OneWire_GpioReadBlock,
+	.Triplet = NULL,
+	.StrongPullup = OneWire_GpioStrongPullup,
+};
+
+//
+//	Strong pull-up driver - the gate of a P-channel MOSFET from the bus to
+//	VDD is pulled low on any transport, otherwise the transport drives it
+//
+static void OneWire_PullupDrive(OneWire_t* onewire, uint8_t on)
+{
+	if (onewire->PullupGPIOx) // Dedicated MOSFET
+		onewire->PullupGPIOx->BSRR = on ? (uint32_t)onewire->PullupPin << 16 : onewire->PullupPin;
+	else if (onewire->Ops->StrongPullup)
+		onewire->Ops->StrongPullup(onewire, on);
+}
+
+uint8_t OneWire_HasStrongPullup(OneWire_t* onewire)
+{
+	return onewire->PullupGPIOx || onewire->Ops->StrongPullup;
+}
+
+//
+//	Strong pull-up - a parasite-powered device takes its conversion and
+//	EEPROM current from the bus line, more than the pull-up resistor
+//	gives. It has to go on within 10 us after the last command bit and
+//	the line must not go low until the operation is done.
+//
+//	Returns:
+//	1 - Strong pull-up on
+//	0 - Transport has none, the line is only kept idle for @ms
+//
+uint8_t OneWire_StrongPullup(OneWire_t* onewire, uint16_t ms)
+{
+	OneWire_PullupDrive(onewire, 1);
+
+	onewire->PullupStart = HAL_GetTick();
+	onewire->PullupTime = ms + 1; // Start could be at the end of a tick
+
+	return OneWire_HasStrongPullup(onewire);
+}
+
+uint8_t OneWire_PullupActive(OneWire_t* onewire)
+{
+	if (!onewire->PullupTime)
+		return 0;
+
+	if (HAL_GetTick() - onewire->PullupStart < onewire->PullupTime)
+		return 1;
+
+	OneWire_PullupDrive(onewire, 0); // Time passed - weak pull-up again
+	onewire->PullupTime = 0;
+
+	return 0;
+}
+
+//
+//	Bus access while the strong pull-up is on waits for its end - without
+//	a transport pull-up the line is just kept idle for that time
+//
+static void OneWire_PullupWait(OneWire_t* onewire)
+{
+	uint32_t elapsed;
+
+	if (!onewire->PullupTime)
+		return;
+
+	elapsed = HAL_GetTick() - onewire->PullupStart;
+	if (elapsed < onewire->PullupTime)
+		HAL_Delay(onewire->PullupTime - elapsed);
+
+	while (OneWire_PullupActive(onewire));
+}
+
+//
+//	1-Wire bus reset signal
+//
+//	Returns:
+//	0 - Reset ok
+//	1 - Error
+//
+uint8_t OneWire_Reset(OneWire_t* onewire)
+{
+	OneWire_PullupWait(onewire);
+
+	return onewire->Ops->Reset(onewire);
+}
+
+//
+//	Writing/Reading operations
+//
+void OneWire_WriteBit(OneWire_t* onewire, uint8_t bit)
+{
+	onewire->Ops->WriteBit(onewire, bit);
+}
+
+uint8_t OneWire_ReadBit(OneWire_t* onewire)
+{
+	OneWire_PullupWait(onewire);
+
+	return onewire->Ops->ReadBit(onewire);
+}
+
+void OneWire_WriteByte(OneWire_t* onewire, uint8_t byte)
+{
+	onewire->Ops->WriteBlock(onewire, &byte, 1);
 }
 
 uint8_t OneWire_ReadByte(OneWire_t* onewire)
 {
-	uint8_t i = 8, byte = 0;
+	uint8_t byte;
 
-	do{
-		byte >>= 1;
-		byte |= (OneWire_ReadBit(onewire) << 7); // LSB first
-	} while(--i);
-	
+	onewire->Ops->ReadBlock(onewire, &byte, 1);
 	return byte;
 }
 
+void OneWire_WriteBlock(OneWire_t* onewire, const uint8_t* data, uint16_t len)
+{
+	onewire->Ops->WriteBlock(onewire, data, len);
+}
+
+void OneWire_ReadBlock(OneWire_t* onewire, uint8_t* data, uint16_t len)
+{
+	onewire->Ops->ReadBlock(onewire, data, len);
+}
+
+//
+//	Search triplet - read bit, read complement, write direction
+//
+uint8_t OneWire_Triplet(OneWire_t* onewire, uint8_t direction)
+{
+	uint8_t id_bit, cmp_id_bit;
+
+	if (onewire->Ops->Triplet)
+		return onewire->Ops->Triplet(onewire, direction);
+
+	id_bit = onewire->Ops->ReadBit(onewire); // Read a bit
+	cmp_id_bit = onewire->Ops->ReadBit(onewire); // Read the complement
+
+	if (id_bit && cmp_id_bit) // No device answered - nothing to write
+		return ONEWIRE_TRIPLET_ID | ONEWIRE_TRIPLET_CMP;
+
+	if (id_bit != cmp_id_bit) // Only one direction is present
+		direction = id_bit;
+
+	onewire->Ops->WriteBit(onewire, direction);
+
+	return (id_bit ? ONEWIRE_TRIPLET_ID : 0) | (cmp_id_bit ? ONEWIRE_TRIPLET_CMP : 0) | (direction ? ONEWIRE_TRIPLET_DIR : 0);
+}
+
 //
 // 1-Wire search operations
 //
@@ -164,7 +415,7 @@ uint8_t OneWire_Search(OneWire_t* onewire, uint8_t command)
 {
 	uint8_t id_bit_number;
 	uint8_t last_zero, rom_byte_number, search_result;
-	uint8_t id_bit, cmp_id_bit;
+	uint8_t id_bit, cmp_id_bit, triplet;
 	uint8_t rom_byte_mask, search_direction;
 
 	id_bit_number = 1;
@@ -186,11 +437,28 @@ uint8_t OneWire_Search(OneWire_t* onewire, uint8_t command)
 
 		OneWire_WriteByte(onewire, command); // Send searching command
 
+		for (rom_byte_number = 0; rom_byte_number < 8; rom_byte_number++)
+			onewire->Discrepancy[rom_byte_number] = 0;
+		rom_byte_number = 0;
+
 		// Searching loop, Maxim APPLICATION NOTE 187
 		do
 		{
-			id_bit = OneWire_ReadBit(onewire); // Read a bit 1
-			cmp_id_bit = OneWire_ReadBit(onewire); // Read the complement of bit 1
+			// Table 3. Search Path Direction - used when both bits are 0
+			if (id_bit_number < onewire->LastDiscrepancy)
+			{
+				search_direction = ((onewire->ROM_NO[rom_byte_number] & rom_byte_mask) > 0);
+			}
+			else
+			{
+				// If bit is equal to last - pick 1
+				// If not - then pick 0
+				search_direction = (id_bit_number == onewire->LastDiscrepancy);
+			}
+
+			triplet = OneWire_Triplet(onewire, search_direction); // Read bit, complement, write direction
+			id_bit = (triplet & ONEWIRE_TRIPLET_ID) ? 1 : 0;
+			cmp_id_bit = (triplet & ONEWIRE_TRIPLET_CMP) ? 1 : 0;
 
 			if ((id_bit == 1) && (cmp_id_bit == 1)) // 11 - data error
 			{
@@ -198,35 +466,21 @@ uint8_t OneWire_Search(OneWire_t* onewire, uint8_t command)
 			}
 			else
 			{
-				if (id_bit != cmp_id_bit)
-				{
-					search_direction = id_bit;  // Bit write value for search
-				}
-				else // 00 - 2 devices
+				if ((id_bit == 0) && (cmp_id_bit == 0)) // 00 - devices on both branches
+					onewire->Discrepancy[rom_byte_number] |= rom_byte_mask;
+
+				if ((id_bit == 0) && (cmp_id_bit == 0) && (search_direction == 0)) // 00 - 2 devices, 0 was picked
 				{
-					// Table 3. Search Path Direction
-					if (id_bit_number < onewire->LastDiscrepancy)
-					{
-						search_direction = ((onewire->ROM_NO[rom_byte_number] & rom_byte_mask) > 0);
-					}
-					else
-					{
-						// If bit is equal to last - pick 1
-						// If not - then pick 0
-						search_direction = (id_bit_number == onewire->LastDiscrepancy);
-					}
+					last_zero = id_bit_number; // Write it to LastZero
 
-					if (search_direction == 0) // If 0 was picked, write it to LastZero
+					if (last_zero < 9) // Check for last discrepancy in family
 					{
-						last_zero = id_bit_number;
-
-						if (last_zero < 9) // Check for last discrepancy in family
-						{
-							onewire->LastFamilyDiscrepancy = last_zero;
-						}
+						onewire->LastFamilyDiscrepancy = last_zero;
 					}
 				}
 
+				search_direction = (triplet & ONEWIRE_TRIPLET_DIR) ? 1 : 0; // Direction actually written
+
 				if (search_direction == 1)
 				{
 					onewire->ROM_NO[rom_byte_number] |= rom_byte_mask; // Set the bit in the ROM byte rom_byte_number
@@ -235,8 +489,6 @@ uint8_t OneWire_Search(OneWire_t* onewire, uint8_t command)
 				{
 					onewire->ROM_NO[rom_byte_number] &= ~rom_byte_mask; // Clear the bit in the ROM byte rom_byte_number
 				}
-				
-				OneWire_WriteBit(onewire, search_direction); // Search direction write bit
 
 				id_bit_number++; // Next bit search - increase the id
 				rom_byte_mask <<= 1; // Shoft the mask for next bit
@@ -294,17 +546,94 @@ uint8_t OneWire_Next(OneWire_t* onewire)
 }
 
 //
-//	Select a device on bus by address
+//	Targeted search, Maxim APPLICATION NOTE 187 - next OneWire_Search
+//	finds the first device of @family, or the next family in search order
+//	when there is none. Further OneWire_Next calls go on from there, so
+//	the devices of one family come one after another.
 //
-void OneWire_Select(OneWire_t* onewire, uint8_t* addr)
+void OneWire_TargetSetup(OneWire_t* onewire, uint8_t family)
 {
 	uint8_t i;
-	OneWire_WriteByte(onewire, ONEWIRE_CMD_MATCHROM); // Match ROM command
-	
-	for (i = 0; i < 8; i++)
+
+	onewire->ROM_NO[0] = family;
+	for (i = 1; i < 8; i++)
+		onewire->ROM_NO[i] = 0;
+
+	onewire->LastDiscrepancy = 64; // Follow ROM_NO on every discrepancy
+	onewire->LastFamilyDiscrepancy = 0;
+	onewire->LastDeviceFlag = 0;
+}
+
+//
+//	Family skip, Maxim APPLICATION NOTE 187 - next OneWire_Search leaves
+//	the family of the last found device and goes to the next one
+//
+void OneWire_FamilySkipSetup(OneWire_t* onewire)
+{
+	onewire->LastDiscrepancy = onewire->LastFamilyDiscrepancy;
+	onewire->LastFamilyDiscrepancy = 0;
+
+	if (onewire->LastDiscrepancy == 0) // No other family on the bus
+		onewire->LastDeviceFlag = 1;
+}
+
+//
+//	Search-based presence check, Maxim APPLICATION NOTE 187 - one search
+//	pass that follows @ROM on every bit and stops as soon as no device
+//	answers on its branch. Search state (ROM_NO, LastDiscrepancy) is
+//	left as it was, a running enumeration goes on after it. Discrepancy
+//	gets the bits where other devices branch off the path.
+//
+//	Returns:
+//	1 - Device with @ROM is on the bus
+//	0 - No device, or no device with @ROM
+//
+uint8_t OneWire_Verify(OneWire_t* onewire, const uint8_t* ROM)
+{
+	uint8_t bit, direction, triplet;
+
+	if (OneWire_Reset(onewire))
+		return 0;
+
+	OneWire_WriteByte(onewire, ONEWIRE_CMD_SEARCHROM);
+
+	for (bit = 0; bit < 8; bit++)
+		onewire->Discrepancy[bit] = 0;
+
+	for (bit = 0; bit < 64; bit++)
 	{
-		OneWire_WriteByte(onewire, *(addr + i));
+		direction = (ROM[bit >> 3] >> (bit & 7)) & 1;
+		triplet = OneWire_Triplet(onewire, direction);
+
+		if (((triplet & ONEWIRE_TRIPLET_DIR) ? 1 : 0) != direction || (triplet & ONEWIRE_TRIPLET_ID && triplet & ONEWIRE_TRIPLET_CMP))
+			return 0; // Path left the ROM - rest of the slots not needed
+
+		if (!(triplet & (ONEWIRE_TRIPLET_ID | ONEWIRE_TRIPLET_CMP))) // 00 - devices on both branches
+			onewire->Discrepancy[bit >> 3] |= 1 << (bit & 7);
 	}
+
+	return 1;
+}
+
+//
+//	Match ROM frame - the command and the ROM go out as one block, a
+//	streaming backend sends it in one transfer
+//
+void OneWire_SelectFrame(uint8_t* frame, const uint8_t* ROM)
+{
+	frame[0] = ONEWIRE_CMD_MATCHROM;
+	memcpy(&frame[1], ROM, 8);
+}
+
+//
+//	Select a device on bus by address
+//
+void OneWire_Select(OneWire_t* onewire, uint8_t* addr)
+{
+	uint8_t frame[ONEWIRE_SELECT_LEN];
+
+	OneWire_SelectFrame(frame, addr);
+	OneWire_WriteBlock(onewire, frame, ONEWIRE_SELECT_LEN);
 }
 
 //
@@ -312,13 +641,7 @@ void OneWire_Select(OneWire_t* onewire, uint8_t* addr)
 //
 void OneWire_SelectWithPointer(OneWire_t* onewire, uint8_t *ROM)
 {
-	uint8_t i;
-	OneWire_WriteByte(onewire, ONEWIRE_CMD_MATCHROM); // Match ROM command
-	
-	for (i = 0; i < 8; i++)
-	{
-		OneWire_WriteByte(onewire, *(ROM + i));
-	}	
+	OneWire_Select(onewire, ROM);
 }
 
 //
@@ -361,18 +684,51 @@ uint8_t OneWire_CRC8(uint8_t *addr, uint8_t len) {
 //
 void OneWire_Init(OneWire_t* onewire, GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
 {
-	HAL_TIM_Base_Start(&_DS18B20_TIMER); // Start the delay timer
+	onewire->Ops = &OneWire_GpioOps; // Bit-bang on the GPIO pin
+	onewire->Backend = NULL;
+	onewire->Timer = &_DS18B20_TIMER;
+	onewire->PullupGPIOx = NULL;
+	onewire->PullupTime = 0;
+	OneWire_ResetSearch(onewire);
+
+	HAL_TIM_Base_Start(onewire->Timer); // Timer of the non-blocking transactions
+	OneWire_TimebaseInit();
+	onewire->SlotEnd = OneWire_Time();
 
 	onewire->GPIOx = GPIOx; // Save 1-wire bus pin
 	onewire->GPIO_Pin = GPIO_Pin;
 
 	// 1-Wire bit bang initialization
-	OneWire_BusOutputDirection(onewire);
-	OneWire_OutputHigh(onewire);
-	HAL_Delay(100);
-	OneWire_OutputLow(onewire);
-	HAL_Delay(100);
-	OneWire_OutputHigh(onewire);
-	HAL_Delay(200);
+	OneWire_OutputHigh(onewire); // Released level first - no glitch when open-drain mode takes the pin
+	OneWire_BusOutputDirection(onewire); // First reset pulse brings the devices to a known state
+}
+
+//
+//	1-Wire initialization on any other transport
+//
+void OneWire_InitWithOps(OneWire_t* onewire, const OneWire_Ops_t* ops, void* backend)
+{
+	onewire->Ops = ops;
+	onewire->Backend = backend;
+	onewire->GPIOx = NULL;
+	onewire->GPIO_Pin = 0;
+	onewire->Timer = NULL;
+	onewire->PullupGPIOx = NULL;
+	onewire->PullupTime = 0;
+
+	OneWire_ResetSearch(onewire);
 }
 
+//
+//	Strong pull-up on a P-channel MOSFET instead of the transport - the
+//	pin has to be a push-pull output already, it is set high (MOSFET off)
+//	here. Call it after the bus init, any transport can use it.
+//
+void OneWire_SetPullupPin(OneWire_t* onewire, GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+	onewire->PullupGPIOx = GPIOx;
+	onewire->PullupPin = GPIO_Pin;
+
+	if (GPIOx)
+		GPIOx->BSRR = GPIO_Pin;
+}
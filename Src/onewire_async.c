@@ -0,0 +1,355 @@
+/*
+ * onewire_async.c
+ *
+ *	The MIT License.
+ *
+ */
+#include "onewire_async.h"
+#ifdef _ONEWIRE_ASYNC_DMA
+#include "onewire_dma.h"
+#endif
+
+#ifndef _ONEWIRE_OPEN_DRAIN
+#error "onewire_async needs the bus pin kept in open-drain output - define _ONEWIRE_OPEN_DRAIN"
+#endif
+
+//
+//	Engine states - every state ends with the time to the next compare event
+//
+typedef enum {
+	ONEWIRE_ASYNC_STATE_START,         // Take the queue head
+	ONEWIRE_ASYNC_STATE_RESET_RELEASE, // Reset pulse done
+	ONEWIRE_ASYNC_STATE_PRESENCE,      // Presence pulse sample
+	ONEWIRE_ASYNC_STATE_SLOT,          // Start of the next bit slot
+	ONEWIRE_ASYNC_STATE_WRITE_RELEASE, // End of the write slot low time
+	ONEWIRE_ASYNC_STATE_READ_RELEASE,  // End of the read slot low time
+	ONEWIRE_ASYNC_STATE_READ_SAMPLE,   // Read slot sample point
+	ONEWIRE_ASYNC_STATE_FINISH,        // Recovery after a failed reset done
+} OneWireAsync_State_t;
+
+//
+//	VARIABLES
+//
+static struct {
+	TIM_HandleTypeDef* Timer;
+	OneWireAsync_t* Head;          // Running transaction
+	OneWireAsync_t* Tail;
+	OneWireAsync_State_t State;
+	uint16_t Bit;                  // Bit number in the transaction, TxData first
+	uint8_t Value;                 // Bit written in the current slot
+	uint8_t InIrq;                 // Submit called from a callback
+} Engine;
+
+//
+//	Slot primitives - pin is an open-drain output
+//
+static inline void OneWireAsync_BusLow(OneWire_t* onewire)
+{
+	onewire->GPIOx->BSRR = onewire->GPIO_Pin<<16;
+}
+
+static inline void OneWireAsync_BusRelease(OneWire_t* onewire)
+{
+	onewire->GPIOx->BSRR = onewire->GPIO_Pin;
+}
+
+static inline uint8_t OneWireAsync_BusRead(OneWire_t* onewire)
+{
+	return (onewire->GPIOx->IDR & onewire->GPIO_Pin) ? 1 : 0;
+}
+
+//
+//	Remove the finished transaction from the queue and report it
+//
+static void OneWireAsync_Finish(void)
+{
+	OneWireAsync_t* transaction = Engine.Head;
+
+	Engine.Head = transaction->Next;
+	Engine.State = ONEWIRE_ASYNC_STATE_START;
+
+	if (transaction->Status == ONEWIRE_ASYNC_PENDING)
+		transaction->Status = ONEWIRE_ASYNC_DONE;
+
+	if (transaction->Callback)
+		transaction->Callback(transaction); // May submit the next transaction
+}
+
+//
+//	One step of the running transaction
+//
+//	Returns:
+//	Microseconds to the next step, 0 - continue at once
+//
+static uint16_t OneWireAsync_Step(void)
+{
+	OneWireAsync_t* transaction = Engine.Head;
+	OneWire_t* onewire;
+	uint16_t bit;
+
+	if (!transaction)
+		return 0;
+
+	onewire = transaction->onewire;
+
+	switch (Engine.State)
+	{
+	case ONEWIRE_ASYNC_STATE_START:
+		Engine.Bit = 0;
+		if (transaction->Reset)
+		{
+			OneWireAsync_BusLow(onewire); // Reset pulse
+			Engine.State = ONEWIRE_ASYNC_STATE_RESET_RELEASE;
+			return 480;
+		}
+		Engine.State = ONEWIRE_ASYNC_STATE_SLOT;
+		return 0;
+
+	case ONEWIRE_ASYNC_STATE_RESET_RELEASE:
+		OneWireAsync_BusRelease(onewire);
+		Engine.State = ONEWIRE_ASYNC_STATE_PRESENCE;
+		return 70;
+
+	case ONEWIRE_ASYNC_STATE_PRESENCE:
+		if (OneWireAsync_BusRead(onewire)) // High - no device on the bus
+		{
+			transaction->Status = ONEWIRE_ASYNC_NO_PRESENCE;
+			Engine.State = ONEWIRE_ASYNC_STATE_FINISH;
+		}
+		else
+			Engine.State = ONEWIRE_ASYNC_STATE_SLOT;
+		return 410;
+
+	case ONEWIRE_ASYNC_STATE_SLOT:
+		if (Engine.Bit < transaction->TxLen * 8) // Write slot, LSB first
+		{
+			Engine.Value = (transaction->TxData[Engine.Bit >> 3] >> (Engine.Bit & 7)) & 1;
+			OneWireAsync_BusLow(onewire);
+			Engine.State = ONEWIRE_ASYNC_STATE_WRITE_RELEASE;
+			return Engine.Value ? 6 : 60;
+		}
+		if (Engine.Bit < (transaction->TxLen + transaction->RxLen) * 8) // Read slot
+		{
+			OneWireAsync_BusLow(onewire);
+			Engine.State = ONEWIRE_ASYNC_STATE_READ_RELEASE;
+			return 2;
+		}
+		OneWireAsync_Finish();
+		return 0;
+
+	case ONEWIRE_ASYNC_STATE_WRITE_RELEASE:
+		OneWireAsync_BusRelease(onewire);
+		Engine.Bit++;
+		Engine.State = ONEWIRE_ASYNC_STATE_SLOT;
+		return Engine.Value ? 64 : 10;
+
+	case ONEWIRE_ASYNC_STATE_READ_RELEASE:
+		OneWireAsync_BusRelease(onewire); // Slave drives the line now
+		Engine.State = ONEWIRE_ASYNC_STATE_READ_SAMPLE;
+		return 10;
+
+	case ONEWIRE_ASYNC_STATE_READ_SAMPLE:
+		bit = Engine.Bit - transaction->TxLen * 8;
+		if (OneWireAsync_BusRead(onewire))
+			transaction->RxData[bit >> 3] |= 1 << (bit & 7);
+		else
+			transaction->RxData[bit >> 3] &= ~(1 << (bit & 7));
+		Engine.Bit++;
+		Engine.State = ONEWIRE_ASYNC_STATE_SLOT;
+		return 50;
+
+	case ONEWIRE_ASYNC_STATE_FINISH:
+	default:
+		OneWireAsync_Finish();
+		return 0;
+	}
+}
+
+//
+//	Next compare event @us after the previous one - interrupt latency
+//	does not add up over the slots
+//
+static void OneWireAsync_Schedule(uint16_t us)
+{
+	TIM_TypeDef* tim = Engine.Timer->Instance;
+	uint16_t compare = (uint16_t)(tim->CCR1 + us);
+
+	tim->CCR1 = compare;
+
+	if ((int16_t)(compare - (uint16_t)tim->CNT) <= 0) // Deadline already passed - run as soon as possible
+	{
+		tim->CCR1 = (uint16_t)(tim->CNT + 2);
+		__HAL_TIM_CLEAR_IT(Engine.Timer, TIM_IT_CC1);
+	}
+}
+
+#ifdef _ONEWIRE_ASYNC_DMA
+//
+//	DMA engine - one transaction at a time from the queue head
+//
+static void OneWireAsync_DmaDone(uint8_t presence);
+
+static void OneWireAsync_Run(void)
+{
+	OneWireAsync_t* transaction;
+	uint8_t inIrq = Engine.InIrq;
+
+	Engine.InIrq = 1; // Callbacks of empty transactions only queue
+	while ((transaction = Engine.Head) && !OneWireDma_Start(transaction->onewire, transaction->Reset,
+			transaction->TxData, transaction->TxLen, transaction->RxData, transaction->RxLen, OneWireAsync_DmaDone))
+		OneWireAsync_Finish(); // Nothing to send
+	Engine.InIrq = inIrq;
+}
+
+static void OneWireAsync_DmaDone(uint8_t presence)
+{
+	if (!presence)
+		Engine.Head->Status = ONEWIRE_ASYNC_NO_PRESENCE;
+
+	Engine.InIrq = 1;
+	OneWireAsync_Finish();
+	OneWireAsync_Run();
+	Engine.InIrq = 0;
+}
+
+//
+//	Transactions
+//
+//	Returns:
+//	1 - Transaction queued
+//	0 - It is still pending, too long for the slot tables or the bus has no GPIO pin
+//
+uint8_t OneWireAsync_Submit(OneWireAsync_t* transaction)
+{
+	uint32_t primask;
+	uint8_t idle;
+
+	if (!Engine.Timer || transaction->Status == ONEWIRE_ASYNC_PENDING || !transaction->onewire->GPIOx ||
+			transaction->TxLen + transaction->RxLen > _ONEWIRE_DMA_MAX_BYTES)
+		return 0;
+
+	transaction->Status = ONEWIRE_ASYNC_PENDING;
+	transaction->Next = NULL;
+
+	primask = __get_PRIMASK();
+	__disable_irq(); // Keep the DMA interrupt away from the queue
+
+	if (Engine.Head)
+		Engine.Tail->Next = transaction;
+	else
+		Engine.Head = transaction;
+	Engine.Tail = transaction;
+
+	idle = !Engine.InIrq && Engine.Head == transaction; // No transaction running - nothing can finish meanwhile
+
+	__set_PRIMASK(primask);
+
+	if (idle)
+	{
+		OneWire_WaitIdle(transaction->onewire); // Blocking slot before still recovering
+		OneWireAsync_Run();
+	}
+
+	return 1;
+}
+#else
+//
+//	Transactions
+//
+//	Returns:
+//	1 - Transaction queued
+//	0 - It is still pending or the bus has no GPIO pin
+//
+uint8_t OneWireAsync_Submit(OneWireAsync_t* transaction)
+{
+	if (!Engine.Timer || transaction->Status == ONEWIRE_ASYNC_PENDING || !transaction->onewire->GPIOx)
+		return 0;
+
+	transaction->Status = ONEWIRE_ASYNC_PENDING;
+	transaction->Next = NULL;
+
+	__HAL_TIM_DISABLE_IT(Engine.Timer, TIM_IT_CC1); // Keep the engine away from the queue
+
+	if (Engine.Head)
+		Engine.Tail->Next = transaction;
+	else
+		Engine.Head = transaction;
+	Engine.Tail = transaction;
+
+	if (Engine.InIrq) // Called from a callback - the handler goes on with the queue
+		return 1;
+
+	if (Engine.Head == transaction) // Engine was idle - start in 2 us
+	{
+		OneWire_WaitIdle(transaction->onewire); // Blocking slot before still recovering
+		Engine.State = ONEWIRE_ASYNC_STATE_START;
+		Engine.Timer->Instance->CCR1 = (uint16_t)(Engine.Timer->Instance->CNT + 2);
+		__HAL_TIM_CLEAR_IT(Engine.Timer, TIM_IT_CC1);
+	}
+
+	__HAL_TIM_ENABLE_IT(Engine.Timer, TIM_IT_CC1);
+
+	return 1;
+}
+
+#endif
+
+uint8_t OneWireAsync_IsBusy(void)
+{
+	return Engine.Head != NULL;
+}
+
+//
+//	Has to be called from TIMx_CC_IRQHandler
+//
+void OneWireAsync_IRQHandler(TIM_HandleTypeDef* htim)
+{
+	uint16_t us;
+
+	if (htim != Engine.Timer || !__HAL_TIM_GET_FLAG(htim, TIM_FLAG_CC1) || !__HAL_TIM_GET_IT_SOURCE(htim, TIM_IT_CC1))
+		return;
+
+	__HAL_TIM_CLEAR_IT(htim, TIM_IT_CC1);
+
+	Engine.InIrq = 1;
+	do
+	{
+		us = OneWireAsync_Step();
+	} while (!us && Engine.Head); // Finished transactions and empty states go on at once
+	Engine.InIrq = 0;
+
+	if (us)
+	{
+		OneWireAsync_Schedule(us);
+		__HAL_TIM_ENABLE_IT(htim, TIM_IT_CC1); // Submit from a callback switched it off
+	}
+	else
+		__HAL_TIM_DISABLE_IT(htim, TIM_IT_CC1); // Queue empty
+}
+
+//
+//	Async engine initialization
+//
+void OneWireAsync_Init(TIM_HandleTypeDef* htim)
+{
+	if (Engine.Timer == htim) // Another bus set it up - keep its queue
+		return;
+
+#ifdef _ONEWIRE_ASYNC_DMA
+	if (!OneWireDma_Init(htim)) // No DMA linked to the timer - Submit refuses
+		return;
+#endif
+
+	Engine.Timer = htim;
+	Engine.Head = NULL;
+	Engine.Tail = NULL;
+	Engine.State = ONEWIRE_ASYNC_STATE_START;
+	Engine.InIrq = 0;
+
+	__HAL_TIM_DISABLE_IT(htim, TIM_IT_CC1);
+
+	htim->Instance->CCMR1 &= ~(TIM_CCMR1_CC1S | TIM_CCMR1_OC1M); // Channel 1 as frozen output compare - timing only
+	htim->Instance->CCER &= ~TIM_CCER_CC1E; // No pin output
+
+	__HAL_TIM_CLEAR_IT(htim, TIM_IT_CC1);
+}
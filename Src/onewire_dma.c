@@ -0,0 +1,218 @@
+/*
+ * onewire_dma.c
+ *
+ *	The MIT License.
+ *
+ */
+#include "onewire_dma.h"
+
+#ifndef _ONEWIRE_OPEN_DRAIN
+#error "onewire_dma needs the bus pin kept in open-drain output - define _ONEWIRE_OPEN_DRAIN"
+#endif
+
+#define ONEWIRE_DMA_MAX_SLOTS	(ONEWIRE_DMA_RESET_TOTAL + _ONEWIRE_DMA_MAX_BYTES * 8)
+
+#define ONEWIRE_DMA_REQUESTS	(TIM_DMA_UPDATE | TIM_DMA_CC2 | TIM_DMA_CC3 | TIM_DMA_CC4)
+
+//
+//	VARIABLES
+//
+static struct {
+	TIM_HandleTypeDef* Timer;
+	volatile uint8_t Busy;         // Transaction running
+	uint16_t Pin;
+	uint8_t Reset;
+	uint8_t TxLen;
+	uint8_t* RxData;
+	uint8_t RxLen;
+	void (*Callback)(uint8_t presence);
+	uint16_t Low[ONEWIRE_DMA_MAX_SLOTS];     // Update - BSRR reset half, pin low
+	uint16_t Release[ONEWIRE_DMA_MAX_SLOTS]; // CC2 - BSRR set half, write 1 and read
+	uint16_t Sample[ONEWIRE_DMA_MAX_SLOTS];  // CC3 - IDR
+	uint16_t Write0[ONEWIRE_DMA_MAX_SLOTS];  // CC4 - BSRR set half, end of every low time
+} Dma;
+
+//
+//	Slot tables - a zero half word leaves the pin as it is
+//
+static void OneWireDma_Slot(uint16_t slot, uint16_t low, uint16_t release, uint16_t write0)
+{
+	Dma.Low[slot] = low;
+	Dma.Release[slot] = release;
+	Dma.Write0[slot] = write0;
+}
+
+static uint16_t OneWireDma_Build(uint16_t pin, uint8_t reset, const uint8_t* tx, uint8_t txlen, uint8_t rxlen)
+{
+	uint16_t slot = 0;
+	uint16_t i;
+
+	if (reset)
+	{
+		for (; slot < ONEWIRE_DMA_RESET_SLOTS; slot++)
+			OneWireDma_Slot(slot, pin, 0, 0); // Held low for 490 us
+		for (; slot < ONEWIRE_DMA_RESET_TOTAL; slot++)
+			OneWireDma_Slot(slot, 0, pin, pin); // Released, presence pulse and recovery
+	}
+
+	for (i = 0; i < txlen * 8; i++, slot++) // Write slots, LSB first
+	{
+		if ((tx[i >> 3] >> (i & 7)) & 1)
+			OneWireDma_Slot(slot, pin, pin, pin);
+		else
+			OneWireDma_Slot(slot, pin, 0, pin);
+	}
+
+	for (i = 0; i < rxlen * 8; i++, slot++) // Read slot is a write 1 slot
+		OneWireDma_Slot(slot, pin, pin, pin);
+
+	return slot;
+}
+
+//
+//	Give the timer back - free running 1 us counter, DMA streams ready
+//
+static void OneWireDma_Stop(void)
+{
+	TIM_HandleTypeDef* htim = Dma.Timer;
+
+	__HAL_TIM_DISABLE_DMA(htim, ONEWIRE_DMA_REQUESTS);
+	htim->Instance->ARR = htim->Init.Period;
+
+	HAL_DMA_Abort(htim->hdma[TIM_DMA_ID_UPDATE]); // Streams ran out already, HAL state goes back to ready
+	HAL_DMA_Abort(htim->hdma[TIM_DMA_ID_CC2]);
+	HAL_DMA_Abort(htim->hdma[TIM_DMA_ID_CC3]);
+	HAL_DMA_Abort(htim->hdma[TIM_DMA_ID_CC4]);
+}
+
+//
+//	DMA callbacks - the release at 60 us of the last slot ends the transaction
+//
+static void OneWireDma_Complete(DMA_HandleTypeDef* hdma)
+{
+	uint16_t first, i;
+	uint8_t presence = 1;
+
+	(void)hdma;
+
+	OneWireDma_Stop();
+
+	if (Dma.Reset)
+		presence = !(Dma.Sample[ONEWIRE_DMA_PRESENCE_SLOT] & Dma.Pin); // Device holds the line low
+
+	first = (Dma.Reset ? ONEWIRE_DMA_RESET_TOTAL : 0) + Dma.TxLen * 8;
+	for (i = 0; i < Dma.RxLen * 8; i++) // LSB first
+	{
+		if (Dma.Sample[first + i] & Dma.Pin)
+			Dma.RxData[i >> 3] |= 1 << (i & 7);
+		else
+			Dma.RxData[i >> 3] &= ~(1 << (i & 7));
+	}
+
+	Dma.Busy = 0;
+
+	if (Dma.Callback)
+		Dma.Callback(presence); // May start the next transaction
+}
+
+static void OneWireDma_Error(DMA_HandleTypeDef* hdma)
+{
+	(void)hdma;
+
+	OneWireDma_Stop();
+	Dma.Busy = 0;
+
+	if (Dma.Callback)
+		Dma.Callback(0);
+}
+
+//
+//	Transactions
+//
+//	Returns:
+//	1 - Transaction running
+//	0 - Engine busy, nothing to do or too long
+//
+uint8_t OneWireDma_Start(OneWire_t* onewire, uint8_t reset, const uint8_t* tx, uint8_t txlen, uint8_t* rx, uint8_t rxlen, void (*callback)(uint8_t presence))
+{
+	TIM_HandleTypeDef* htim = Dma.Timer;
+	TIM_TypeDef* tim;
+	uintptr_t bsrr;
+	uint16_t slots;
+
+	if (!htim || Dma.Busy || !onewire->GPIOx || txlen + rxlen > _ONEWIRE_DMA_MAX_BYTES)
+		return 0;
+
+	slots = OneWireDma_Build(onewire->GPIO_Pin, reset, tx, txlen, rxlen);
+	if (!slots)
+		return 0;
+
+	Dma.Busy = 1;
+	Dma.Pin = onewire->GPIO_Pin;
+	Dma.Reset = reset;
+	Dma.TxLen = txlen;
+	Dma.RxData = rx;
+	Dma.RxLen = rxlen;
+	Dma.Callback = callback;
+
+	bsrr = (uintptr_t)&onewire->GPIOx->BSRR;
+
+	if (HAL_DMA_Start(htim->hdma[TIM_DMA_ID_UPDATE], (uintptr_t)Dma.Low, bsrr + 2, slots) != HAL_OK ||
+			HAL_DMA_Start(htim->hdma[TIM_DMA_ID_CC2], (uintptr_t)Dma.Release, bsrr, slots) != HAL_OK ||
+			HAL_DMA_Start(htim->hdma[TIM_DMA_ID_CC3], (uintptr_t)&onewire->GPIOx->IDR, (uintptr_t)Dma.Sample, slots) != HAL_OK ||
+			HAL_DMA_Start_IT(htim->hdma[TIM_DMA_ID_CC4], (uintptr_t)Dma.Write0, bsrr, slots) != HAL_OK)
+	{
+		OneWireDma_Stop();
+		Dma.Busy = 0;
+		return 0;
+	}
+
+	tim = htim->Instance;
+	tim->ARR = ONEWIRE_DMA_SLOT - 1;
+	tim->CCR2 = ONEWIRE_DMA_RELEASE;
+	tim->CCR3 = ONEWIRE_DMA_SAMPLE;
+	tim->CCR4 = ONEWIRE_DMA_WRITE0;
+
+	__HAL_TIM_ENABLE_DMA(htim, ONEWIRE_DMA_REQUESTS);
+	tim->EGR = TIM_EGR_UG; // Counter to 0 and the first update request - slot 0 starts now
+
+	return 1;
+}
+
+uint8_t OneWireDma_IsBusy(void)
+{
+	return Dma.Busy;
+}
+
+//
+//	DMA engine initialization
+//
+//	Returns:
+//	1 - Timer is ready for transactions
+//	0 - Update, CC2, CC3 or CC4 request has no DMA stream linked
+//
+uint8_t OneWireDma_Init(TIM_HandleTypeDef* htim)
+{
+	TIM_TypeDef* tim = htim->Instance;
+
+	if (!htim->hdma[TIM_DMA_ID_UPDATE] || !htim->hdma[TIM_DMA_ID_CC2] || !htim->hdma[TIM_DMA_ID_CC3] || !htim->hdma[TIM_DMA_ID_CC4])
+		return 0;
+
+	if (Dma.Timer == htim) // Another bus set it up
+		return 1;
+
+	Dma.Timer = htim;
+	Dma.Busy = 0;
+
+	htim->hdma[TIM_DMA_ID_CC4]->XferCpltCallback = OneWireDma_Complete;
+	htim->hdma[TIM_DMA_ID_CC4]->XferErrorCallback = OneWireDma_Error;
+
+	__HAL_TIM_DISABLE_DMA(htim, ONEWIRE_DMA_REQUESTS);
+
+	tim->CCMR1 &= ~(TIM_CCMR1_CC2S | TIM_CCMR1_OC2M); // Channels 2 - 4 as frozen output compare - timing only
+	tim->CCMR2 &= ~(TIM_CCMR2_CC3S | TIM_CCMR2_OC3M | TIM_CCMR2_CC4S | TIM_CCMR2_OC4M);
+	tim->CCER &= ~(TIM_CCER_CC2E | TIM_CCER_CC3E | TIM_CCER_CC4E); // No pin output
+	tim->CR2 &= ~TIM_CR2_CCDS; // Requests on the compare events, not on update
+
+	return 1;
+}
@@ -0,0 +1,162 @@
+/*
+ * onewire_multi.c
+ *
+ *	The MIT License.
+ *
+ */
+#include "onewire_multi.h"
+
+//
+//	Slot start - the rest of the last recovery time, then all buses low.
+//	Phases are deadlines from the returned falling edge.
+//
+static uint32_t OneWireMulti_SlotStart(OneWireMulti_t* multi, uint16_t pins)
+{
+	if (multi->SlotEnd - OneWire_Time() <= OneWire_Cycles(ONEWIRE_RECOVERY_MAX)) // Long past deadlines would look ahead
+		OneWire_WaitUntil(multi->SlotEnd);
+
+	multi->GPIOx->BSRR = (uint32_t)pins << 16; // All buses low
+
+	return OneWire_Time();
+}
+
+//
+//	Bus reset signal on all @pins
+//
+//	Returns:
+//	Pins which answered with a presence pulse
+//
+uint16_t OneWireMulti_Reset(OneWireMulti_t* multi, uint16_t pins)
+{
+	uint32_t start;
+	uint16_t presence;
+
+	start = OneWireMulti_SlotStart(multi, pins);
+	OneWire_WaitUntil(start + OneWire_Cycles(480));
+
+	multi->GPIOx->BSRR = pins; // Release
+	OneWire_WaitUntil(start + OneWire_Cycles(480 + 70));
+
+	presence = ~multi->GPIOx->IDR & pins; // Low - device present
+	multi->SlotEnd = start + OneWire_Cycles(480 + 70 + 410);
+	OneWire_WaitUntil(multi->SlotEnd);
+
+	return presence;
+}
+
+//
+//	Slots - all buses start and end together, only the release differs
+//
+static void OneWireMulti_WriteSlot(OneWireMulti_t* multi, uint16_t pins, uint16_t ones)
+{
+	uint32_t start;
+
+	start = OneWireMulti_SlotStart(multi, pins);
+	OneWire_WaitUntil(start + OneWire_Cycles(6));
+
+	multi->GPIOx->BSRR = ones; // Buses writing '1' are released
+	OneWire_WaitUntil(start + OneWire_Cycles(60));
+
+	multi->GPIOx->BSRR = pins; // '0' ends after 60 us
+	multi->SlotEnd = start + OneWire_Cycles(70);
+}
+
+static uint16_t OneWireMulti_ReadSlot(OneWireMulti_t* multi, uint16_t pins)
+{
+	uint32_t start;
+	uint16_t bits;
+
+	start = OneWireMulti_SlotStart(multi, pins); // Low to initiate reading
+	OneWire_WaitUntil(start + OneWire_Cycles(2));
+
+	multi->GPIOx->BSRR = pins; // Release for slave responses
+	OneWire_WaitUntil(start + OneWire_Cycles(12));
+
+	bits = multi->GPIOx->IDR & pins; // One read samples every bus
+	multi->SlotEnd = start + OneWire_Cycles(62);
+
+	return bits;
+}
+
+//
+//	Writing/Reading operations
+//
+void OneWireMulti_WriteByte(OneWireMulti_t* multi, uint16_t pins, uint8_t byte)
+{
+	uint8_t i = 8;
+
+	do
+	{
+		OneWireMulti_WriteSlot(multi, pins, (byte & 1) ? pins : 0); // LSB first
+		byte >>= 1;
+	} while(--i);
+}
+
+void OneWireMulti_WriteBlock(OneWireMulti_t* multi, uint16_t pins, const uint8_t* data, uint8_t len)
+{
+	uint16_t ones[8];
+	uint8_t i, bit, bus;
+
+	for (i = 0; i < len; i++)
+	{
+		for (bit = 0; bit < 8; bit++) // Gather the bit of every bus before the slots
+		{
+			ones[bit] = 0;
+			for (bus = 0; bus < ONEWIRE_MULTI_MAX_BUSES; bus++)
+			{
+				if ((pins & (1U << bus)) && (data[bus * len + i] & (1 << bit)))
+					ones[bit] |= 1U << bus;
+			}
+		}
+
+		for (bit = 0; bit < 8; bit++)
+			OneWireMulti_WriteSlot(multi, pins, ones[bit]);
+	}
+}
+
+void OneWireMulti_ReadBlock(OneWireMulti_t* multi, uint16_t pins, uint8_t* data, uint8_t len)
+{
+	uint16_t bits[8];
+	uint8_t i, bit, bus, byte;
+
+	for (i = 0; i < len; i++)
+	{
+		for (bit = 0; bit < 8; bit++)
+			bits[bit] = OneWireMulti_ReadSlot(multi, pins);
+
+		for (bus = 0; bus < ONEWIRE_MULTI_MAX_BUSES; bus++) // Spread the samples over buses, LSB first
+		{
+			if (!(pins & (1U << bus)))
+				continue;
+
+			byte = 0;
+			for (bit = 0; bit < 8; bit++)
+			{
+				if (bits[bit] & (1U << bus))
+					byte |= 1 << bit;
+			}
+			data[bus * len + i] = byte;
+		}
+	}
+}
+
+//
+//	Multi-bus initialization
+//
+void OneWireMulti_Init(OneWireMulti_t* multi, GPIO_TypeDef* GPIOx, uint16_t GPIO_Pins)
+{
+	GPIO_InitTypeDef	GPIO_InitStruct;
+
+	multi->GPIOx = GPIOx;
+	multi->GPIO_Pins = GPIO_Pins;
+
+	OneWire_TimebaseInit();
+	multi->SlotEnd = OneWire_Time();
+
+	GPIOx->BSRR = GPIO_Pins; // Released level first
+	GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD; // Open-drain - released pins are read back through IDR
+	GPIO_InitStruct.Pull = GPIO_NOPULL; // No pullup - the pullup resistors are external
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_MEDIUM;
+	GPIO_InitStruct.Pin = GPIO_Pins;
+	HAL_GPIO_Init(GPIOx, &GPIO_InitStruct);
+}
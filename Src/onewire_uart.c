@@ -0,0 +1,372 @@
+/*
+ * onewire_uart.c
+ *
+ *	The MIT License.
+ *
+ */
+#include <string.h>
+#include "onewire_uart.h"
+
+#define ONEWIRE_UART_FRAME_1		0xFF // Short start bit only - write 1 or read slot
+#define ONEWIRE_UART_FRAME_0		0x00 // Low for 9 bit times - write 0
+#define ONEWIRE_UART_FRAME_RESET	0xF0 // ~520 us low at 9600 baud
+
+//
+//	Baud rate switching
+//
+static uint32_t OneWireUart_Brr(UART_HandleTypeDef* huart, uint32_t baud)
+{
+	uint32_t pclk;
+
+#if defined(USART6)
+	if ((huart->Instance == USART1) || (huart->Instance == USART6))
+#else
+	if (huart->Instance == USART1)
+#endif
+		pclk = HAL_RCC_GetPCLK2Freq();
+	else
+		pclk = HAL_RCC_GetPCLK1Freq();
+
+	return UART_BRR_SAMPLING16(pclk, baud);
+}
+
+//
+//	Waits have a deadline on the cycle counter - a USART without clock,
+//	DMA link or RX callback fails the call instead of hanging it
+//
+static uint32_t OneWireUart_Deadline(uint16_t us)
+{
+	return OneWire_Time() + OneWire_Cycles(us);
+}
+
+static uint8_t OneWireUart_Expired(uint32_t deadline)
+{
+	return (int32_t)(OneWire_Time() - deadline) >= 0;
+}
+
+static uint8_t OneWireUart_SetBrr(OneWireUart_t* uart, uint32_t brr)
+{
+	uint32_t deadline = OneWireUart_Deadline(ONEWIRE_UART_FRAME_TIMEOUT);
+
+	if (uart->huart->Instance->BRR == brr)
+		return 1;
+
+	while (!__HAL_UART_GET_FLAG(uart->huart, UART_FLAG_TC)) // Let the last frame go out
+	{
+		if (OneWireUart_Expired(deadline))
+			return 0;
+	}
+
+	__HAL_UART_DISABLE(uart->huart);
+	uart->huart->Instance->BRR = brr;
+	__HAL_UART_ENABLE(uart->huart);
+
+	return 1;
+}
+
+//
+//	Send one frame and return its echo
+//
+//	Returns:
+//	1 - Echo in @echo
+//	0 - No echo in time
+//
+static uint8_t OneWireUart_Exchange(OneWireUart_t* uart, uint8_t frame, uint8_t* echo)
+{
+	USART_TypeDef* usart = uart->huart->Instance;
+	uint32_t deadline = OneWireUart_Deadline(ONEWIRE_UART_FRAME_TIMEOUT);
+
+	while (usart->SR & USART_SR_RXNE) // Drop stale echoes
+		(void)usart->DR;
+	__HAL_UART_CLEAR_OREFLAG(uart->huart);
+
+	while (!(usart->SR & USART_SR_TXE))
+	{
+		if (OneWireUart_Expired(deadline))
+			return 0;
+	}
+	usart->DR = frame;
+
+	deadline = OneWireUart_Deadline(ONEWIRE_UART_FRAME_TIMEOUT);
+	while (!(usart->SR & USART_SR_RXNE)) // Echo comes after the stop bit
+	{
+		if (OneWireUart_Expired(deadline))
+			return 0;
+	}
+
+	*echo = (uint8_t)usart->DR;
+	return 1;
+}
+
+//
+//	Bus reset
+//
+//	Returns:
+//	0 - Reset ok
+//	1 - Error
+//
+uint8_t OneWireUart_Reset(OneWireUart_t* uart)
+{
+	uint8_t echo = ONEWIRE_UART_FRAME_RESET, sent;
+
+	sent = OneWireUart_SetBrr(uart, uart->BrrReset) && OneWireUart_Exchange(uart, ONEWIRE_UART_FRAME_RESET, &echo);
+	OneWireUart_SetBrr(uart, uart->BrrData);
+
+	return !sent || (echo == ONEWIRE_UART_FRAME_RESET); // Presence pulse changes the echo
+}
+
+//
+//	One bit slot - a slot that did not go out reads 1, like an open bus
+//
+uint8_t OneWireUart_Bit(OneWireUart_t* uart, uint8_t bit)
+{
+	uint8_t echo;
+
+	if (!OneWireUart_Exchange(uart, bit ? ONEWIRE_UART_FRAME_1 : ONEWIRE_UART_FRAME_0, &echo))
+		return 1;
+
+	return echo == ONEWIRE_UART_FRAME_1;
+}
+
+//
+//	The echo of the last frame completes a transaction in the middle of
+//	its stop bit, HAL gives the TX side back only in the TC interrupt
+//	after it. A transaction started before that gets HAL_BUSY.
+//
+static uint8_t OneWireUart_WaitReady(OneWireUart_t* uart)
+{
+	uint32_t deadline = OneWireUart_Deadline(ONEWIRE_UART_READY_TIMEOUT);
+
+	while (uart->huart->gState != HAL_UART_STATE_READY || uart->huart->RxState != HAL_UART_STATE_READY)
+	{
+		if (OneWireUart_Expired(deadline)) // TC interrupt blocked or USART stuck
+			return 0;
+	}
+
+	return 1;
+}
+
+//
+//	DMA transactions
+//
+//	Returns:
+//	1 - Transaction running
+//	0 - Transaction in progress, bad length or USART not ready
+//
+uint8_t OneWireUart_Start(OneWireUart_t* uart, const uint8_t* tx, uint8_t txlen, uint8_t rxlen, void (*callback)(OneWireUart_t* uart))
+{
+	uint16_t i, frames;
+	uint8_t byte, j;
+
+	if (uart->Busy || (txlen + rxlen) > _ONEWIRE_UART_MAX_BYTES || !(txlen + rxlen))
+		return 0;
+
+	if (!OneWireUart_WaitReady(uart))
+		return 0;
+
+	for (i = 0; i < txlen; i++) // Every bit becomes one frame, LSB first
+	{
+		byte = tx[i];
+		for (j = 0; j < 8; j++)
+		{
+			uart->Frames[i * 8 + j] = (byte & 1) ? ONEWIRE_UART_FRAME_1 : ONEWIRE_UART_FRAME_0;
+			byte >>= 1;
+		}
+	}
+
+	frames = (txlen + rxlen) * 8;
+	for (i = txlen * 8; i < frames; i++) // Read slots
+		uart->Frames[i] = ONEWIRE_UART_FRAME_1;
+
+	uart->TxLen = txlen;
+	uart->RxLen = rxlen;
+	uart->Callback = callback;
+	if (!OneWireUart_SetBrr(uart, uart->BrrData))
+		return 0;
+
+	uart->Busy = 1;
+
+	while (uart->huart->Instance->SR & USART_SR_RXNE)
+		(void)uart->huart->Instance->DR;
+	__HAL_UART_CLEAR_OREFLAG(uart->huart);
+
+	// The same buffer is used both ways: the echo of frame n is written
+	// after frame n+1 was already taken by the TX stream.
+	if (HAL_UART_Receive_DMA(uart->huart, uart->Frames, frames) != HAL_OK)
+	{
+		uart->Busy = 0;
+		return 0;
+	}
+
+	if (HAL_UART_Transmit_DMA(uart->huart, uart->Frames, frames) != HAL_OK)
+	{
+		HAL_UART_AbortReceive(uart->huart);
+		uart->Busy = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+uint8_t OneWireUart_IsBusy(OneWireUart_t* uart)
+{
+	return uart->Busy;
+}
+
+//
+//	Has to be called from HAL_UART_RxCpltCallback
+//
+void OneWireUart_RxCpltCallback(OneWireUart_t* uart, UART_HandleTypeDef* huart)
+{
+	uint8_t i, j, byte;
+	uint8_t* frame;
+
+	if (huart != uart->huart || !uart->Busy)
+		return;
+
+	frame = &uart->Frames[uart->TxLen * 8];
+	for (i = 0; i < uart->RxLen; i++) // Decode read slots, LSB first
+	{
+		byte = 0;
+		for (j = 0; j < 8; j++)
+		{
+			byte >>= 1;
+			if (*frame++ == ONEWIRE_UART_FRAME_1)
+				byte |= 0x80;
+		}
+		uart->RxData[i] = byte;
+	}
+
+	uart->Busy = 0;
+
+	if (uart->Callback)
+		uart->Callback(uart);
+}
+
+//
+//	End of a blocking transaction - it is aborted when the RX callback
+//	does not come within the time of its frames
+//
+static uint8_t OneWireUart_Wait(OneWireUart_t* uart, uint8_t bytes)
+{
+	uint32_t deadline = OneWireUart_Deadline(bytes * 8 * ONEWIRE_UART_FRAME_TIME + ONEWIRE_UART_READY_TIMEOUT);
+
+	while (uart->Busy)
+	{
+		if (OneWireUart_Expired(deadline))
+		{
+			HAL_UART_Abort(uart->huart);
+			uart->Busy = 0;
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+//
+//	Blocking block transfers on top of the DMA transaction
+//
+//	Returns:
+//	1 - Block transferred
+//	0 - USART failed, a read block is all ones like an open bus
+//
+uint8_t OneWireUart_WriteBlock(OneWireUart_t* uart, const uint8_t* data, uint16_t len)
+{
+	while (len)
+	{
+		uint8_t chunk = (len > _ONEWIRE_UART_MAX_BYTES) ? _ONEWIRE_UART_MAX_BYTES : len;
+
+		if (!OneWireUart_Start(uart, data, chunk, 0, NULL) || !OneWireUart_Wait(uart, chunk))
+			return 0;
+
+		data += chunk;
+		len -= chunk;
+	}
+
+	return 1;
+}
+
+uint8_t OneWireUart_ReadBlock(OneWireUart_t* uart, uint8_t* data, uint16_t len)
+{
+	uint8_t i;
+
+	while (len)
+	{
+		uint8_t chunk = (len > _ONEWIRE_UART_MAX_BYTES) ? _ONEWIRE_UART_MAX_BYTES : len;
+
+		if (!OneWireUart_Start(uart, NULL, 0, chunk, NULL) || !OneWireUart_Wait(uart, chunk))
+		{
+			memset(data, 0xFF, len); // No stale bytes - CRC and range checks reject it
+			return 0;
+		}
+
+		for (i = 0; i < chunk; i++)
+			data[i] = uart->RxData[i];
+
+		data += chunk;
+		len -= chunk;
+	}
+
+	return 1;
+}
+
+//
+//	OneWire_t backend
+//
+static uint8_t OneWireUart_OpReset(OneWire_t* onewire)
+{
+	return OneWireUart_Reset(onewire->Backend);
+}
+
+static void OneWireUart_OpWriteBit(OneWire_t* onewire, uint8_t bit)
+{
+	OneWireUart_Bit(onewire->Backend, bit);
+}
+
+static uint8_t OneWireUart_OpReadBit(OneWire_t* onewire)
+{
+	return OneWireUart_Bit(onewire->Backend, 1); // Read slot is a write 1 slot
+}
+
+static void OneWireUart_OpWriteBlock(OneWire_t* onewire, const uint8_t* data, uint16_t len)
+{
+	OneWireUart_WriteBlock(onewire->Backend, data, len);
+}
+
+static void OneWireUart_OpReadBlock(OneWire_t* onewire, uint8_t* data, uint16_t len)
+{
+	OneWireUart_ReadBlock(onewire->Backend, data, len);
+}
+
+const OneWire_Ops_t OneWireUart_Ops = {
+	.Reset = OneWireUart_OpReset,
+	.WriteBit = OneWireUart_OpWriteBit,
+	.ReadBit = OneWireUart_OpReadBit,
+	.WriteBlock = OneWireUart_OpWriteBlock,
+	.ReadBlock = OneWireUart_OpReadBlock,
+	.Triplet = NULL,
+};
+
+//
+//	UART 1-Wire initialization
+//
+void OneWireUart_Init(OneWireUart_t* uart, UART_HandleTypeDef* huart)
+{
+	OneWire_TimebaseInit(); // Timeout of the USART ready wait
+
+	uart->huart = huart;
+	uart->Busy = 0;
+	uart->Callback = NULL;
+
+	uart->BrrReset = OneWireUart_Brr(huart, ONEWIRE_UART_RESET_BAUD);
+	uart->BrrData = OneWireUart_Brr(huart, ONEWIRE_UART_DATA_BAUD);
+
+	OneWireUart_SetBrr(uart, uart->BrrData);
+}
+
+void OneWire_InitUart(OneWire_t* onewire, OneWireUart_t* uart, UART_HandleTypeDef* huart)
+{
+	OneWireUart_Init(uart, huart);
+	OneWire_InitWithOps(onewire, &OneWireUart_Ops, uart);
+}